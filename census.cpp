@@ -0,0 +1,370 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Object census and memory growth
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qapplication.h>
+#include <qwidget.h>
+#include <qstringlist.h>
+#include <qpair.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <algorithm>
+#include "census.h"
+#include "puppeteer.h"
+
+ObjectCensus::ObjectCensus(int window)
+: mObjects(0), mWidgets(0), mWindow(window < 2? 2 : window), mSamples(0)
+{
+}
+
+void
+ObjectCensus::childEvent(QObject *object, QEvent *event)
+{
+	QObject *child = 0;
+
+	if (event->type() != QEvent::Destroy)
+		child = ((QChildEvent *) event)->child();
+
+	switch (event->type()) {
+	case QEvent::ChildAdded:
+		// Reparented; it brings its children along
+		if (mDetached.remove(child)) {
+			mLive[child].parent = object;
+			mChildren.insert(object, child);
+			break;
+		}
+
+		// Possibly a new object at the address of one we missed the end of
+		if (mLive.contains(child))
+			forget(child);
+		mPending.insert(child);
+		break;
+
+	case QEvent::ChildPolished:
+		if (mPending.contains(child))
+			resolve(child);
+		break;
+
+	case QEvent::ChildRemoved:
+		// Being deleted, or about to be added to another parent
+		if (mPending.remove(child) || !mLive.contains(child))
+			break;
+		mChildren.remove(object, child);
+		mLive[child].parent = 0;
+		mDetached.insert(child);
+		break;
+
+	case QEvent::Destroy:
+		forget(object);
+		break;
+
+	default: ;
+	}
+}
+
+/*
+ * A new parent would have told us by now
+ */
+void
+ObjectCensus::flushDetached()
+{
+	QList<QObject *> detached = mDetached.toList();
+
+	mDetached.clear();
+	for (int i = 0; i < detached.count(); ++i)
+		forget(detached[i]);
+}
+
+void
+ObjectCensus::resolve(QObject *object)
+{
+	Entry entry;
+
+	entry.meta = object->metaObject();
+	entry.parent = object->parent();
+
+	mPending.remove(object);
+	mLive.insert(object, entry);
+	if (entry.parent)
+		mChildren.insert(entry.parent, object);
+
+	mClasses[entry.meta]++;
+	mObjects++;
+	if (object->isWidgetType()) {
+		mWidgetClasses.insert(entry.meta);
+		mWidgets++;
+	}
+}
+
+/*
+ * The object is gone, and so are its children. Don't touch any of them.
+ */
+void
+ObjectCensus::forget(QObject *object)
+{
+	QHash<QObject *, Entry>::iterator it;
+	QList<QObject *> children;
+	Entry entry;
+
+	if (mPending.remove(object))
+		return;
+	if ((it = mLive.find(object)) == mLive.end())
+		return;
+
+	entry = it.value();
+	mLive.erase(it);
+	mDetached.remove(object);
+	if (entry.parent)
+		mChildren.remove(entry.parent, object);
+
+	mClasses[entry.meta]--;
+	mObjects--;
+	if (mWidgetClasses.contains(entry.meta))
+		mWidgets--;
+
+	children = mChildren.values(object);
+	mChildren.remove(object);
+	for (int i = 0; i < children.count(); ++i)
+		forget(children[i]);
+}
+
+void
+ObjectCensus::visit(QObject *object)
+{
+	const QObjectList &children = object->children();
+
+	if (mLive.contains(object))
+		return;
+
+	resolve(object);
+	for (int i = 0; i < children.count(); ++i)
+		visit(children[i]);
+}
+
+void
+ObjectCensus::walk()
+{
+	QWidgetList widgets = qApp->allWidgets();
+
+	mLive.clear();
+	mChildren.clear();
+	mPending.clear();
+	mDetached.clear();
+	mClasses.clear();
+	mObjects = mWidgets = 0;
+
+	visit(qApp);
+
+	// Windows, and widgets that are not even that
+	for (int i = 0; i < widgets.count(); ++i) {
+		if (widgets[i]->parent() == 0)
+			visit(widgets[i]);
+	}
+}
+
+unsigned long
+ObjectCensus::residentKB()
+{
+	unsigned long size = 0, resident = 0;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/self/statm", "r")) == NULL)
+		return 0;
+	if (fscanf(fp, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(fp);
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*
+ * What the application has malloc'ed and not freed, including
+ * large blocks that malloc mmap'ed separately
+ */
+unsigned long
+ObjectCensus::heapKB()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 info = mallinfo2();
+#else
+	struct mallinfo info = mallinfo();
+#endif
+
+	return ((unsigned long) info.uordblks + (unsigned long) info.hblkhd) / 1024;
+}
+
+void
+ObjectCensus::sample(const QString &label)
+{
+	QList<QPair<int, const QMetaObject *> > growing;
+	const Sample *first;
+	QStringList what;
+	Sample sample;
+	bool rssUp = true, heapUp = true, objectsUp = true;
+
+	sample.label = label;
+	sample.rss = residentKB();
+	sample.heap = heapKB();
+	sample.objects = mObjects;
+	sample.widgets = mWidgets;
+	sample.classes = mClasses;
+
+	printf("=== Memory at %s: rss %lu KB, heap %lu KB, %d objects, %d widgets\n",
+			qPrintable(label), sample.rss, sample.heap, sample.objects, sample.widgets);
+
+	// The first iteration warms up caches and the like
+	if (mSamples++ < 2)
+		mBaseline = sample;
+
+	mRecent.append(sample);
+	if (mRecent.count() > mWindow)
+		mRecent.removeFirst();
+	if (mRecent.count() < mWindow)
+		return;
+
+	for (int i = 1; i < mRecent.count(); ++i) {
+		rssUp = rssUp && mRecent[i].rss > mRecent[i - 1].rss;
+		heapUp = heapUp && mRecent[i].heap > mRecent[i - 1].heap;
+		objectsUp = objectsUp && mRecent[i].objects > mRecent[i - 1].objects;
+	}
+
+	first = &mRecent.first();
+	if (rssUp)
+		what.append(QString("rss +%1 KB").arg(sample.rss - first->rss));
+	if (heapUp)
+		what.append(QString("heap +%1 KB").arg(sample.heap - first->heap));
+	if (objectsUp)
+		what.append(QString("objects +%1").arg(sample.objects - first->objects));
+
+	for (QHash<const QMetaObject *, int>::const_iterator it = sample.classes.begin(); it != sample.classes.end(); ++it) {
+		bool up = true;
+
+		for (int i = 1; i < mRecent.count() && up; ++i)
+			up = mRecent[i].classes.value(it.key()) > mRecent[i - 1].classes.value(it.key());
+		if (up)
+			growing.append(qMakePair(it.value() - first->classes.value(it.key()), it.key()));
+	}
+	std::sort(growing.begin(), growing.end());
+	std::reverse(growing.begin(), growing.end());
+	for (int i = 0; i < growing.count() && i < 5; ++i)
+		what.append(QString("%1 +%2").arg(growing[i].second->className()).arg(growing[i].first));
+
+	if (!what.isEmpty())
+		printf("=== Growing in each of the last %d samples: %s\n", mWindow, qPrintable(what.join(", ")));
+}
+
+long
+ObjectCensus::rssGrowth() const
+{
+	if (mRecent.isEmpty())
+		return 0;
+	return (long) mRecent.last().rss - (long) mBaseline.rss;
+}
+
+int
+ObjectCensus::objectGrowth() const
+{
+	if (mRecent.isEmpty())
+		return 0;
+	return mRecent.last().objects - mBaseline.objects;
+}
+
+void
+ObjectCensus::report(unsigned int top)
+{
+	QList<QPair<int, const QMetaObject *> > changed;
+	const Sample *last;
+
+	if (mSamples < 2)
+		return;
+	last = &mRecent.last();
+
+	printf("=== Memory growth from %s to %s: rss %+ld KB, heap %+ld KB, objects %+d, widgets %+d\n",
+			qPrintable(mBaseline.label), qPrintable(last->label),
+			(long) last->rss - (long) mBaseline.rss, (long) last->heap - (long) mBaseline.heap,
+			last->objects - mBaseline.objects, last->widgets - mBaseline.widgets);
+
+	for (QHash<const QMetaObject *, int>::const_iterator it = last->classes.begin(); it != last->classes.end(); ++it) {
+		int delta = it.value() - mBaseline.classes.value(it.key());
+
+		if (delta > 0)
+			changed.append(qMakePair(delta, it.key()));
+	}
+	if (changed.isEmpty())
+		return;
+
+	std::sort(changed.begin(), changed.end());
+	std::reverse(changed.begin(), changed.end());
+
+	printf("===   Classes with more live objects than at the start:\n");
+	for (int i = 0; i < changed.count() && (unsigned int) i < top; ++i)
+		printf("===   %+8d %8d  %s\n", changed[i].first,
+				last->classes.value(changed[i].second), changed[i].second->className());
+}
+
+/*
+ * PUPPETEER_MEMORY, for soak tests. Samples are taken before every
+ * script of a session, and every so many seconds if the value is a
+ * number.
+ */
+void
+Puppeteer::memoryStart(const char *interval)
+{
+	const char *value;
+	int window = 5;
+
+	if ((value = getenv("PUPPETEER_MEMORY_WINDOW")) != NULL)
+		window = atoi(value);
+	if ((value = getenv("PUPPETEER_MEMORY_MAX_RSS")) != NULL)
+		mMemoryMaxRss = atol(value);
+	if ((value = getenv("PUPPETEER_MEMORY_MAX_OBJECTS")) != NULL)
+		mMemoryMaxObjects = atoi(value);
+
+	mCensus = new ObjectCensus(window);
+
+	if (atoi(interval) > 0) {
+		connect(&mMemoryTimer, SIGNAL(timeout()), this, SLOT(memoryTimerSlot()));
+		mMemoryTimer.start(1000 * atoi(interval));
+	}
+
+	printf("=== Tracking memory and live objects\n");
+	qApp->installEventFilter(this);
+}
+
+/*
+ * In between iterations, the counts we kept up to date from events will do
+ */
+void
+Puppeteer::memoryTimerSlot()
+{
+	if (!memorySample(QString("%1 sec").arg(timestampUsec() / 1000000), false) && mPlayback)
+		playbackTerminate(ExitFail);
+}
+
+/*
+ * Returns false if growth exceeds the limits we were given
+ */
+bool
+Puppeteer::memorySample(const QString &label, bool walk)
+{
+	if (walk)
+		mCensus->walk();
+	mCensus->sample(label);
+
+	if (mMemoryMaxRss > 0 && mCensus->rssGrowth() > mMemoryMaxRss) {
+		printf("=== Resident set grew by %ld KB, more than PUPPETEER_MEMORY_MAX_RSS allows\n",
+				mCensus->rssGrowth());
+		return false;
+	}
+	if (mMemoryMaxObjects > 0 && mCensus->objectGrowth() > mMemoryMaxObjects) {
+		printf("=== %d more live objects, more than PUPPETEER_MEMORY_MAX_OBJECTS allows\n",
+				mCensus->objectGrowth());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,109 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Object census and memory growth
+//
+//	We keep count of the live QObjects per class. The counts
+//	follow ChildAdded and ChildRemoved events; an object is
+//	only counted once it is polished or receives an event of
+//	its own, as it is still being constructed when its parent
+//	is told about it. A child removed from its parent goes
+//	away with all of its descendants, unless it turns up
+//	again right away under a new parent. Objects without a
+//	parent never show up that way, so a walk of the object
+//	tree from the application and its windows sets the counts
+//	straight for every sample that matters.
+//
+//	Each sample also has the resident set size of the process
+//	and the heap in use. Soak tests take one per iteration;
+//	when a figure went up in every one of the last few, it is
+//	reported as growing.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_CENSUS_H
+#define PUPPETEER_CENSUS_H
+
+#include <qobject.h>
+#include <qevent.h>
+#include <qhash.h>
+#include <qset.h>
+#include <qlist.h>
+#include <qstring.h>
+
+class ObjectCensus {
+public:
+	ObjectCensus(int window);
+
+	// Called from the event filter
+	void			observeEvent(QObject *object, QEvent *event)
+				{
+					switch (event->type()) {
+					case QEvent::ChildAdded:
+					case QEvent::ChildPolished:
+					case QEvent::ChildRemoved:
+					case QEvent::Destroy:
+						childEvent(object, event);
+						break;
+					default:
+						if (!mDetached.isEmpty())
+							flushDetached();
+						if (!mPending.isEmpty() && mPending.contains(object))
+							resolve(object);
+					}
+				}
+
+	// Count everything reachable from the application and its windows
+	void			walk();
+
+	int			objects() const { return mObjects; }
+	int			widgets() const { return mWidgets; }
+
+	// Take a sample, print it, and whatever is growing
+	void			sample(const QString &label);
+
+	// Growth since the baseline, which is the sample after the warm-up
+	long			rssGrowth() const;
+	int			objectGrowth() const;
+
+	void			report(unsigned int top);
+
+private:
+	struct Sample {
+		QString		label;
+		unsigned long	rss;		// KB
+		unsigned long	heap;		// KB
+		int		objects;
+		int		widgets;
+		QHash<const QMetaObject *, int> classes;
+	};
+
+	struct Entry {
+		const QMetaObject *meta;
+		QObject *	parent;
+	};
+
+	void			childEvent(QObject *, QEvent *);
+	void			flushDetached();
+	void			resolve(QObject *);
+	void			forget(QObject *);
+	void			visit(QObject *);
+
+	static unsigned long	residentKB();
+	static unsigned long	heapKB();
+
+	QHash<QObject *, Entry>	mLive;
+	QMultiHash<QObject *, QObject *> mChildren;
+	QSet<QObject *>		mPending;	// not fully constructed yet
+	QSet<QObject *>		mDetached;	// removed from their parent, not yet added to another
+	QHash<const QMetaObject *, int> mClasses;
+	QSet<const QMetaObject *> mWidgetClasses;
+	int			mObjects;
+	int			mWidgets;
+
+	int			mWindow;
+	QList<Sample>		mRecent;	// the last mWindow samples
+	Sample			mBaseline;
+	int			mSamples;
+};
+
+#endif /* PUPPETEER_CENSUS_H */
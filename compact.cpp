@@ -0,0 +1,55 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Compact binary event records
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qevent.h>
+
+#include "compact.h"
+
+void
+compactFillEvent(CompactRecord *rec, QEvent *event)
+{
+	rec->eventType = event->type();
+
+	switch (event->type()) {
+	case QEvent::MouseButtonPress:
+	case QEvent::MouseButtonRelease:
+	case QEvent::MouseButtonDblClick:
+	case QEvent::MouseMove: {
+		QMouseEvent *ev = (QMouseEvent *) event;
+
+		rec->x = ev->x();
+		rec->y = ev->y();
+		rec->button = ev->button();
+		rec->buttons = ev->buttons();
+		rec->modifiers = ev->modifiers();
+		break;
+	}
+
+	case QEvent::KeyPress:
+	case QEvent::KeyRelease: {
+		QKeyEvent *ev = (QKeyEvent *) event;
+
+		rec->key = ev->key();
+		rec->modifiers = ev->modifiers();
+		break;
+	}
+
+	default: ;
+	}
+}
+
+QByteArray
+compactEventText(QEvent *event)
+{
+	switch (event->type()) {
+	case QEvent::KeyPress:
+	case QEvent::KeyRelease:
+		return ((QKeyEvent *) event)->text().toUtf8();
+
+	default:
+		return QByteArray();
+	}
+}
@@ -0,0 +1,67 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Compact binary event records
+//
+//	A fixed size header, optionally followed by a short
+//	payload (the text of a key event, or the object path of
+//	a path definition). Object paths are not repeated in every
+//	record; a CompactPath record assigns an id to a path once,
+//	and later records refer to that id.
+//
+//	Records are padded to a multiple of 8 bytes.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_COMPACT_H
+#define PUPPETEER_COMPACT_H
+
+#include <stdint.h>
+
+enum CompactKind {
+	CompactPad = 0,			// Filler up to the end of a ring buffer
+	CompactEvent = 1,
+	CompactPath = 2,		// Payload is the UTF-8 object path for pathId
+};
+
+struct CompactRecord {
+	uint16_t		size;		// including header and padding
+	uint8_t			kind;
+	uint8_t			flags;
+	uint32_t		pathId;		// 0 if none
+
+	uint64_t		seq;
+	uint64_t		usec;		// see Puppeteer::timestampUsec()
+
+	uint16_t		eventType;	// QEvent::Type
+	uint16_t		button;		// Mouse events
+	uint16_t		buttons;
+	uint16_t		payload;	// length of payload
+
+	uint32_t		modifiers;	// Mouse and key events
+	int32_t			key;
+
+	int32_t			x, y;
+};
+
+#define COMPACT_MAX_PAYLOAD	1024
+
+static inline unsigned int
+compactRecordSize(unsigned int payload)
+{
+	return (sizeof(CompactRecord) + payload + 7) & ~7U;
+}
+
+static inline const char *
+compactPayload(const CompactRecord *rec)
+{
+	return (const char *) (rec + 1);
+}
+
+class QEvent;
+class QByteArray;
+
+// Fill in the event specific fields; the payload, if any, is the text
+extern void		compactFillEvent(CompactRecord *, QEvent *);
+extern QByteArray	compactEventText(QEvent *);
+
+#endif /* PUPPETEER_COMPACT_H */
@@ -0,0 +1,292 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Out of process controller
+//
+//	With PUPPETEER_CONTROLLER=/path/to/socket, we listen on a
+//	Unix domain socket instead of loading a script. A controller
+//	connects and sends script actions as XML, one line at a
+//	time; a line may hold several actions, and the controller
+//	need not wait for one line to complete before sending the
+//	next. Actions are queued and executed just like a script,
+//	and event matching still happens in our event filter.
+//
+//	For each line, we answer
+//	  <queued first="N" count="M"/>  or  <error .../>
+//	and for each action, once it is done,
+//	  <result seq="N" status="PASS|FAIL|TIMEOUT|SKIPPED"/>
+//	preceded by <matched seq="N">...</matched> for a wait-event,
+//	and by the widget tree for a <snapshot/>. After a failure,
+//	all actions still queued are skipped.
+//
+//	Replies are written to a non-blocking socket. Whatever the
+//	controller doesn't read right away is kept until it does,
+//	so a controller that stops reading cannot stall the GUI
+//	thread.
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qapplication.h>
+#include <qsocketnotifier.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "puppeteer.h"
+
+bool
+Puppeteer::controllerStart(const char *path)
+{
+	struct sockaddr_un sun;
+	int fd;
+
+	playbackSetup();
+	mScript = new Script;
+
+	if (strlen(path) >= sizeof(sun.sun_path)) {
+		fprintf(stderr, "=== Controller socket path too long: %s\n", path);
+		goto failed;
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strcpy(sun.sun_path, path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		perror("socket");
+		goto failed;
+	}
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *) &sun, sizeof(sun)) < 0 || listen(fd, 1) < 0) {
+		perror(path);
+		close(fd);
+		goto failed;
+	}
+
+	// A controller that goes away should not take us with it
+	signal(SIGPIPE, SIG_IGN);
+
+	mControllerListen = fd;
+	mControllerAcceptNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+	connect(mControllerAcceptNotifier, SIGNAL(activated(int)), SLOT(controllerAcceptSlot()));
+
+	if (mTrace)
+		traceScriptStart(path);
+
+	printf("=== Waiting for controller on %s\n", path);
+	return true;
+
+failed:
+	mExitStatus = ExitScriptError;
+	if (mFailurePolicy != FailureContinue)
+		_exit(ExitScriptError);
+	return false;
+}
+
+/*
+ * mControllerOut is a stdio stream on top of this, so replies can be
+ * written with fprintf() and RecordNode::write()
+ */
+ssize_t
+Puppeteer::controllerCookieWrite(void *cookie, const char *data, size_t size)
+{
+	Puppeteer *self = (Puppeteer *) cookie;
+
+	self->mControllerOutput.append(data, size);
+	self->controllerWriteSlot();
+	return size;
+}
+
+void
+Puppeteer::controllerAcceptSlot()
+{
+	static cookie_io_functions_t cookieFunctions = {
+		NULL, controllerCookieWrite, NULL, NULL
+	};
+	int fd;
+
+	if ((fd = accept(mControllerListen, NULL, NULL)) < 0) {
+		perror("accept");
+		return;
+	}
+
+	if (mControllerFd >= 0) {
+		static const char busy[] = "<error reason=\"busy\"/>\n";
+
+		write(fd, busy, sizeof(busy) - 1);
+		close(fd);
+		return;
+	}
+
+	printf("=== Controller connected\n");
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	mControllerFd = fd;
+	mControllerOut = fopencookie(this, "w", cookieFunctions);
+	mControllerReadNotifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+	connect(mControllerReadNotifier, SIGNAL(activated(int)), SLOT(controllerReadSlot()));
+	mControllerWriteNotifier = new QSocketNotifier(fd, QSocketNotifier::Write, this);
+	mControllerWriteNotifier->setEnabled(false);
+	connect(mControllerWriteNotifier, SIGNAL(activated(int)), SLOT(controllerWriteSlot()));
+
+	fprintf(mControllerOut, "<hello application=\"%s\" pid=\"%d\"/>\n",
+			qPrintable(qApp->applicationName()), getpid());
+	fflush(mControllerOut);
+}
+
+void
+Puppeteer::controllerReadSlot()
+{
+	char buffer[4096];
+	ssize_t n;
+	int nl;
+
+	if ((n = read(mControllerFd, buffer, sizeof(buffer))) <= 0) {
+		if (n < 0)
+			perror("controller");
+		controllerDisconnect();
+		return;
+	}
+
+	mControllerInput.append(buffer, n);
+	while (mControllerOut && (nl = mControllerInput.indexOf('\n')) >= 0) {
+		QByteArray line = mControllerInput.left(nl).trimmed();
+
+		mControllerInput.remove(0, nl + 1);
+		if (!line.isEmpty())
+			controllerCommand(line);
+	}
+}
+
+void
+Puppeteer::controllerWriteSlot()
+{
+	ssize_t n;
+
+	while (!mControllerOutput.isEmpty()) {
+		if ((n = write(mControllerFd, mControllerOutput.constData(), mControllerOutput.size())) < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN) {
+				// The controller went away; reading will tell us
+				mControllerOutput.clear();
+			}
+			break;
+		}
+		mControllerOutput.remove(0, n);
+	}
+
+	if (mControllerWriteNotifier)
+		mControllerWriteNotifier->setEnabled(!mControllerOutput.isEmpty());
+}
+
+/*
+ * Wait a little for the controller to take what is left
+ */
+void
+Puppeteer::controllerDrain(int msec)
+{
+	struct pollfd pfd;
+
+	pfd.fd = mControllerFd;
+	pfd.events = POLLOUT;
+	while (!mControllerOutput.isEmpty() && poll(&pfd, 1, msec) > 0)
+		controllerWriteSlot();
+}
+
+void
+Puppeteer::controllerCommand(const QByteArray &line)
+{
+	bool idle = (mScript->currentAction() == 0);
+	int before = mScript->count(), added;
+	Script::Action *action;
+
+	if (!mScript->append(QString::fromUtf8(line))) {
+		fprintf(mControllerOut, "<error reason=\"parse\"/>\n");
+		fflush(mControllerOut);
+		return;
+	}
+
+	added = mScript->count() - before;
+	fprintf(mControllerOut, "<queued first=\"%u\" count=\"%d\"/>\n", mControllerQueued, added);
+	fflush(mControllerOut);
+	mControllerQueued += added;
+
+	// Get things going again if we were waiting for the controller
+	if (idle && (action = mScript->currentAction()) != 0) {
+		// Waiting for the controller is no part of the step
+		if (mTrace)
+			mTraceStepStart = timestampUsec();
+
+		playbackDescribeAction(action);
+		if (applicationActive || action->type() != Script::WaitEvent)
+			playbackArmTimer(action);
+	}
+}
+
+void
+Puppeteer::controllerResult(unsigned int seq, const char *status)
+{
+	fprintf(mControllerOut, "<result seq=\"%u\" status=\"%s\"/>\n", seq, status);
+	fflush(mControllerOut);
+}
+
+void
+Puppeteer::controllerMatched(const EventRecord *rec)
+{
+	fprintf(mControllerOut, "<matched seq=\"%u\">\n", mControllerSeq);
+	rec->write(mControllerOut, 2);
+	fprintf(mControllerOut, "</matched>\n");
+}
+
+/*
+ * Report the failed action, and skip everything queued after it;
+ * those actions most likely assumed that it would succeed.
+ */
+void
+Puppeteer::controllerFailure(ExitStatus status)
+{
+	int count = mScript->count();
+
+	controllerResult(mControllerSeq++, exitStatusName(status));
+	while (--count > 0)
+		controllerResult(mControllerSeq++, "SKIPPED");
+
+	delete mScript;
+	mScript = new Script;
+}
+
+void
+Puppeteer::controllerDisconnect()
+{
+	printf("=== Controller disconnected\n");
+
+	// We may be called from the read notifier's activated() signal
+	mControllerReadNotifier->setEnabled(false);
+	mControllerReadNotifier->deleteLater();
+	mControllerReadNotifier = 0;
+	mControllerWriteNotifier->setEnabled(false);
+	mControllerWriteNotifier->deleteLater();
+	mControllerWriteNotifier = 0;
+
+	fclose(mControllerOut);
+	mControllerOut = 0;
+	close(mControllerFd);
+	mControllerFd = -1;
+	mControllerInput.clear();
+	mControllerOutput.clear();
+
+	// Nobody is left to care about whatever is still queued
+	mTimer.stop();
+	delete mScript;
+	mScript = new Script;
+	mControllerSeq = mControllerQueued;
+}
@@ -0,0 +1,219 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Export of events through a shared memory ring buffer
+//
+//	The producer runs on the GUI thread, so everything here
+//	sticks to filling in a fixed size header and a memcpy or
+//	two. The only expensive operation, building the object
+//	path, happens once per object, in the path table.
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qfile.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "eventexport.h"
+#include "pathtable.h"
+#include "puppeteer.h"
+
+EventExporter::EventExporter(PathTable *paths)
+: mPaths(paths), mFd(-1), mRing(0), mData(0), mPolicy(PolicyDrop),
+  mHead(0), mOldest(0), mSeq(0)
+{
+}
+
+EventExporter::~EventExporter()
+{
+	close();
+}
+
+bool
+EventExporter::open(const QString &path, unsigned long capacity, Policy policy)
+{
+	QString procPath;
+	size_t size;
+	void *addr;
+
+	capacity = (capacity + 7) & ~7UL;
+	size = sizeof(ExportRingHeader) + capacity;
+
+	if ((mFd = memfd_create("puppeteer-events", 0)) < 0) {
+		perror("memfd_create");
+		return false;
+	}
+
+	if (ftruncate(mFd, size) < 0
+	 || (addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0)) == MAP_FAILED) {
+		perror("event export ring");
+		::close(mFd);
+		mFd = -1;
+		return false;
+	}
+
+	mRing = (ExportRingHeader *) addr;
+	mData = (char *) (mRing + 1);
+	mPolicy = policy;
+
+	mRing->capacity = capacity;
+	mRing->policy = policy;
+	mRing->version = EXPORT_RING_VERSION;
+	__atomic_store_n(&mRing->magic, EXPORT_RING_MAGIC, __ATOMIC_RELEASE);
+
+	// Readers find the memfd through /proc
+	procPath.sprintf("/proc/%d/fd/%d", getpid(), mFd);
+	QFile::remove(path);
+	if (symlink(QFile::encodeName(procPath), QFile::encodeName(path)) < 0) {
+		perror(qPrintable(path));
+		close();
+		return false;
+	}
+	mLinkPath = path;
+
+	printf("=== Exporting events to %s (%lu KB ring)\n", qPrintable(path), capacity / 1024);
+	return true;
+}
+
+void
+EventExporter::close()
+{
+	if (mRing == 0)
+		return;
+
+	__atomic_store_n(&mRing->closed, 1, __ATOMIC_RELEASE);
+	munmap(mRing, sizeof(ExportRingHeader) + mRing->capacity);
+	mRing = 0;
+	mData = 0;
+
+	::close(mFd);
+	mFd = -1;
+
+	if (!mLinkPath.isEmpty())
+		QFile::remove(mLinkPath);
+	mLinkPath = QString();
+}
+
+CompactRecord *
+EventExporter::recordAt(quint64 pos) const
+{
+	return (CompactRecord *) (mData + pos % mRing->capacity);
+}
+
+/*
+ * Find room for a record of the given size, or return NULL if the
+ * policy says to drop it.
+ */
+CompactRecord *
+EventExporter::reserve(unsigned int size)
+{
+	quint64 capacity = mRing->capacity;
+	quint64 contiguous = capacity - mHead % capacity;
+	quint64 needed = size;
+
+	// Records don't wrap around the end of the ring
+	if (contiguous < size)
+		needed += contiguous;
+
+	if (mPolicy == PolicyOverwrite) {
+		quint64 limit = mHead + needed - capacity;
+
+		if (mHead + needed > capacity && mOldest < limit) {
+			while (mOldest < limit)
+				mOldest += recordAt(mOldest)->size;
+
+			// Tell the reader before we start scribbling over the records
+			__atomic_store_n(&mRing->oldest, mOldest, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+		}
+	} else {
+		quint64 tail = __atomic_load_n(&mRing->tail, __ATOMIC_ACQUIRE);
+
+		while (mHead + needed - tail > capacity) {
+			if (mPolicy != PolicyBlock) {
+				__atomic_store_n(&mRing->dropped, mRing->dropped + 1, __ATOMIC_RELAXED);
+				mSeq++;
+				return 0;
+			}
+
+			usleep(100);
+			tail = __atomic_load_n(&mRing->tail, __ATOMIC_ACQUIRE);
+		}
+	}
+
+	if (contiguous < size) {
+		CompactRecord *pad = recordAt(mHead);
+
+		pad->size = contiguous;
+		pad->kind = CompactPad;
+		mHead += contiguous;
+	}
+
+	CompactRecord *rec = recordAt(mHead);
+
+	memset(rec, 0, sizeof(*rec));
+	rec->size = size;
+	rec->seq = mSeq++;
+	return rec;
+}
+
+void
+EventExporter::commit(CompactRecord *rec)
+{
+	mHead += rec->size;
+	__atomic_store_n(&mRing->head, mHead, __ATOMIC_RELEASE);
+}
+
+bool
+EventExporter::exportPath(quint32 pathId)
+{
+	QByteArray path = QByteArray(mPaths->utf8(pathId)).left(COMPACT_MAX_PAYLOAD);
+	CompactRecord *rec;
+
+	if ((rec = reserve(compactRecordSize(path.size()))) == 0)
+		return false;
+
+	rec->kind = CompactPath;
+	rec->pathId = pathId;
+	rec->usec = Puppeteer::timestampUsec();
+	rec->payload = path.size();
+	memcpy(rec + 1, path.constData(), path.size());
+	commit(rec);
+
+	mPathsExported.insert(pathId, mHead - rec->size);
+	return true;
+}
+
+void
+EventExporter::exportEvent(quint32 pathId, QEvent *event)
+{
+	QByteArray text;
+	CompactRecord *rec;
+
+	if (mRing == 0)
+		return;
+
+	// The reader needs to know the path before it sees the first event for it,
+	// and a reader that starts at "oldest" needs to find it after that
+	if (pathId) {
+		QHash<quint32, quint64>::const_iterator it = mPathsExported.find(pathId);
+
+		if ((it == mPathsExported.end() || *it < mOldest) && !exportPath(pathId))
+			pathId = 0;
+	}
+
+	text = compactEventText(event).left(COMPACT_MAX_PAYLOAD);
+	if ((rec = reserve(compactRecordSize(text.size()))) == 0)
+		return;
+
+	rec->kind = CompactEvent;
+	rec->pathId = pathId;
+	rec->usec = Puppeteer::timestampUsec();
+	compactFillEvent(rec, event);
+
+	rec->payload = text.size();
+	memcpy(rec + 1, text.constData(), text.size());
+
+	commit(rec);
+}
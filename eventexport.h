@@ -0,0 +1,90 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Export of events through a shared memory ring buffer
+//
+//	The ring lives in a memfd mapped by the application (the
+//	single producer) and by a reader process (the single
+//	consumer). head and tail count bytes ever written and
+//	consumed; records never wrap, a CompactPad record fills
+//	the space at the end of the buffer instead.
+//
+//	When the ring is full, the producer does one of
+//	  drop       discard the new record (the default)
+//	  overwrite  discard the oldest records, moving "oldest"
+//	  block      wait for the reader
+//	Every record carries a sequence number, including the
+//	ones that got dropped, so readers can tell what they
+//	missed.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_EVENTEXPORT_H
+#define PUPPETEER_EVENTEXPORT_H
+
+#include <qhash.h>
+#include <qstring.h>
+#include <qevent.h>
+
+#include "compact.h"
+
+#define EXPORT_RING_MAGIC	0x50505452	/* PPTR */
+#define EXPORT_RING_VERSION	1
+
+struct ExportRingHeader {
+	uint32_t		magic;
+	uint32_t		version;
+	uint64_t		capacity;	// bytes of record data following the header
+	uint32_t		policy;
+	uint32_t		closed;		// set by the producer when it's done
+
+	// Written by the producer
+	uint64_t		head __attribute__((aligned(64)));
+	uint64_t		oldest;		// overwrite policy only
+	uint64_t		dropped;
+
+	// Written by the consumer
+	uint64_t		tail __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+class PathTable;
+
+class EventExporter {
+public:
+	enum Policy {
+		PolicyDrop,
+		PolicyOverwrite,
+		PolicyBlock,
+	};
+
+	EventExporter(PathTable *paths);
+	~EventExporter();
+
+	// Creates the ring, and a symlink to it at the given path
+	bool			open(const QString &path, unsigned long capacity, Policy policy);
+	void			close();
+
+	void			exportEvent(quint32 pathId, QEvent *);
+
+private:
+	bool			exportPath(quint32 pathId);
+	CompactRecord *		reserve(unsigned int size);
+	void			commit(CompactRecord *);
+	CompactRecord *		recordAt(quint64 pos) const;
+
+	PathTable *		mPaths;
+	// Where in the ring each path was written; overwritten ones are written again
+	QHash<quint32, quint64>	mPathsExported;
+
+	QString			mLinkPath;
+	int			mFd;
+	ExportRingHeader *	mRing;
+	char *			mData;
+	Policy			mPolicy;
+
+	// Producer side copies of what's in the ring header
+	quint64			mHead;
+	quint64			mOldest;
+	quint64			mSeq;
+};
+
+#endif /* PUPPETEER_EVENTEXPORT_H */
@@ -0,0 +1,222 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Cost of event handling
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qapplication.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <algorithm>
+#include "eventprofile.h"
+#include "pathtable.h"
+#include "namespace.h"
+#include "trace.h"
+#include "puppeteer.h"
+
+uint
+qHash(const EventProfile::Key &key)
+{
+	return key.type ^ (key.pathId << 10) ^ (uint) ((quintptr) key.className >> 3);
+}
+
+EventProfile::EventProfile(PathTable *paths)
+: mPaths(paths), mDepth(0)
+{
+	// Don't grow in the middle of things
+	mIndex.reserve(4096);
+	mCosts.reserve(4096);
+}
+
+void
+EventProfile::leave(QEvent::Type type, const char *className, quint32 pathId)
+{
+	QHash<Key, int>::const_iterator it;
+	quint64 total, self;
+	Cost *cost;
+	Key key;
+
+	if (--mDepth >= MaxDepth)
+		return;
+
+	total = now() - mStack[mDepth].start;
+	self = total - mStack[mDepth].children;
+	if (mDepth > 0)
+		mStack[mDepth - 1].children += total;
+
+	key.type = type;
+	key.pathId = pathId;
+	key.className = className;
+
+	if ((it = mIndex.constFind(key)) != mIndex.constEnd()) {
+		cost = &mCosts[it.value()];
+	} else {
+		mIndex.insert(key, mCosts.count());
+		mCosts.resize(mCosts.count() + 1);
+
+		cost = &mCosts.last();
+		cost->key = key;
+		cost->count = cost->total = cost->self = cost->max = 0;
+	}
+
+	cost->count++;
+	cost->total += total;
+	cost->self += self;
+	if (self > cost->max)
+		cost->max = self;
+}
+
+bool
+EventProfile::bySelfTime(const Cost *a, const Cost *b)
+{
+	return a->self > b->self;
+}
+
+void
+EventProfile::report(unsigned int top)
+{
+	QVector<const Cost *> sorted;
+	unsigned int n;
+
+	if (mCosts.isEmpty())
+		return;
+
+	for (int i = 0; i < mCosts.count(); ++i)
+		sorted.append(&mCosts[i]);
+	std::sort(sorted.begin(), sorted.end(), bySelfTime);
+
+	n = qMin(top, (unsigned int) sorted.count());
+	printf("=== Event handling cost, top %u of %d by time spent in the handler itself:\n",
+			n, sorted.count());
+	printf("===      count    self ms   total ms   max ms  event, class, object\n");
+	for (unsigned int i = 0; i < n; ++i) {
+		const Cost *cost = sorted[i];
+
+		printf("=== %10llu %10.1f %10.1f %8.2f  %s, %s, %s\n",
+				(unsigned long long) cost->count,
+				cost->self / 1e6, cost->total / 1e6, cost->max / 1e6,
+				eventTypeName((QEvent::Type) cost->key.type),
+				cost->key.className,
+				cost->key.pathId? qPrintable(mPaths->path(cost->key.pathId)) : "");
+	}
+}
+
+/*
+ * The hook. QCoreApplication::notifyInternal() calls us before it does
+ * anything else, and lets us take over if we return true. We do, and
+ * deliver the event by calling notifyInternal() once more, which sees us
+ * again and is told to go ahead this time. That way, we are around both
+ * before and after delivery, without subclassing QApplication.
+ */
+typedef bool		(*NotifyInternalFunc)(QCoreApplication *, QObject *, QEvent *);
+
+static NotifyInternalFunc theNotifyInternal;
+static pthread_t	theGuiThread;
+static QEvent *		theReentry;
+static unsigned int	theNotifyUsers;
+
+static bool
+profileNotifyCallback(void **data)
+{
+	QObject *receiver = (QObject *) data[0];
+	QEvent *event = (QEvent *) data[1];
+	bool *result = (bool *) data[2];
+
+	// Second time around, for the event we're delivering ourselves
+	if (event == theReentry) {
+		theReentry = 0;
+		return false;
+	}
+
+	if (receiver == 0 || event == 0 || !pthread_equal(pthread_self(), theGuiThread))
+		return false;
+
+	*result = Puppeteer::instance()->profileNotify(receiver, event);
+	return true;
+}
+
+bool
+Puppeteer::profileNotify(QObject *receiver, QEvent *event)
+{
+	// The receiver may not survive the event
+	QEvent::Type type = event->type();
+	const char *className = receiver->metaObject()->className();
+	quint32 pathId = internObjectPath(receiver);
+	quint64 started = 0;
+	int track = 0;
+	bool result;
+
+	if (mTrace) {
+		track = mTrace->track(receiver);
+		started = timestampUsec();
+	}
+	if (mProfile)
+		mProfile->enter();
+
+	theReentry = event;
+	result = theNotifyInternal(qApp, receiver, event);
+
+	if (mProfile)
+		mProfile->leave(type, className, pathId);
+	if (mTrace)
+		traceEventHandled(track, type, className, pathId, started);
+
+	return result;
+}
+
+/*
+ * Both the event profile and the trace use the hook; it stays
+ * installed as long as one of them does.
+ */
+bool
+Puppeteer::notifyHookStart()
+{
+	if (theNotifyUsers++ > 0)
+		return true;
+
+	theNotifyInternal = (NotifyInternalFunc)
+		dlsym(RTLD_DEFAULT, "_ZN16QCoreApplication14notifyInternalEP7QObjectP6QEvent");
+	if (theNotifyInternal == 0) {
+		fprintf(stderr, "=== Cannot hook event delivery, QCoreApplication::notifyInternal not found\n");
+		theNotifyUsers = 0;
+		return false;
+	}
+
+	theGuiThread = pthread_self();
+	QInternal::registerCallback(QInternal::EventNotifyCallback, profileNotifyCallback);
+	return true;
+}
+
+void
+Puppeteer::notifyHookStop()
+{
+	if (theNotifyUsers == 0 || --theNotifyUsers > 0)
+		return;
+
+	QInternal::unregisterCallback(QInternal::EventNotifyCallback, profileNotifyCallback);
+}
+
+void
+Puppeteer::profileStart(const char *top)
+{
+	if (!notifyHookStart())
+		return;
+
+	mProfileTop = atoi(top) > 0? atoi(top) : 20;
+
+	if (mPaths == 0)
+		mPaths = new PathTable;
+	mProfile = new EventProfile(mPaths);
+
+	printf("=== Profiling event handlers\n");
+}
+
+void
+Puppeteer::profileReport()
+{
+	notifyHookStop();
+	mProfile->report(mProfileTop);
+}
@@ -0,0 +1,92 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Cost of event handling
+//
+//	An event filter only sees events before they are delivered,
+//	so it cannot tell how long their handlers take. Instead, we
+//	hook into QCoreApplication::notifyInternal() and time the
+//	whole delivery of every event on the GUI thread, including
+//	all event filters and the receiver's event handler.
+//
+//	Costs are added up per event type, receiver class and
+//	object path. Events delivered while handling another one
+//	count for themselves, and are subtracted from the self
+//	time of the outer one.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_EVENTPROFILE_H
+#define PUPPETEER_EVENTPROFILE_H
+
+#include <qevent.h>
+#include <qhash.h>
+#include <qvector.h>
+#include <time.h>
+
+class PathTable;
+
+class EventProfile {
+public:
+	EventProfile(PathTable *paths);
+
+	// Bracket the delivery of one event
+	void			enter()
+				{
+					if (mDepth < MaxDepth) {
+						mStack[mDepth].start = now();
+						mStack[mDepth].children = 0;
+					}
+					mDepth++;
+				}
+	void			leave(QEvent::Type, const char *className, quint32 pathId);
+
+	void			report(unsigned int top);
+
+	// In nsec; the monotonic clock is a vDSO call, close enough to rdtsc
+	static quint64		now()
+				{
+					struct timespec ts;
+
+					clock_gettime(CLOCK_MONOTONIC, &ts);
+					return (quint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+				}
+
+private:
+	enum { MaxDepth = 128 };
+
+	struct Key {
+		quint32		type;
+		quint32		pathId;
+		const char *	className;	// from the meta object, so it stays around
+
+		bool		operator==(const Key &other) const
+				{
+					return type == other.type && pathId == other.pathId
+					    && className == other.className;
+				}
+	};
+
+	struct Cost {
+		Key		key;
+		quint64		count;
+		quint64		total;		// nsec, including nested events
+		quint64		self;
+		quint64		max;
+	};
+
+	struct Frame {
+		quint64		start;
+		quint64		children;
+	};
+
+	friend uint		qHash(const Key &);
+	static bool		bySelfTime(const Cost *, const Cost *);
+
+	PathTable *		mPaths;
+	QHash<Key, int>		mIndex;
+	QVector<Cost>		mCosts;
+	Frame			mStack[MaxDepth];
+	int			mDepth;
+};
+
+#endif /* PUPPETEER_EVENTPROFILE_H */
@@ -0,0 +1,297 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Reader for the shared memory event export
+//
+//	puppeteer-events [-n] ring
+//	puppeteer-events [-n] dumpfile
+//
+//	Prints every event exported by an application running
+//	with PUPPETEER_EXPORT=ring, until the application exits,
+//	or all events in a flight recorder dump.
+//	With -n, print nothing but a summary at the end.
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qhash.h>
+#include <qfile.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include "eventexport.h"
+#include "namespace.h"
+
+static void
+usage(int exitval)
+{
+	fprintf(stderr,
+		"Usage: puppeteer-events [-n] ring|dumpfile\n"
+		"  -n            count events only, don't print them\n"
+		"The ring is the path given to the application in PUPPETEER_EXPORT,\n"
+		"the dump file the one given in PUPPETEER_FLIGHT_RECORDER\n");
+	exit(exitval);
+}
+
+/*
+ * Map the ring, if that's what the path refers to
+ */
+static ExportRingHeader *
+attach(const char *path)
+{
+	ExportRingHeader header;
+	void *addr;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		perror(path);
+		exit(1);
+	}
+
+	// Anything else is most likely a flight recorder dump
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header)
+	 || header.magic != EXPORT_RING_MAGIC
+	 || header.version != EXPORT_RING_VERSION) {
+		close(fd);
+		return 0;
+	}
+	close(fd);
+
+	// We need write access to tell the producer how far we got
+	if ((fd = open(path, O_RDWR)) < 0) {
+		perror(path);
+		exit(1);
+	}
+
+	addr = mmap(NULL, sizeof(ExportRingHeader) + header.capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (addr == MAP_FAILED) {
+		perror(path);
+		exit(1);
+	}
+	return (ExportRingHeader *) addr;
+}
+
+static void
+printEvent(const CompactRecord *rec, const QHash<uint32_t, QByteArray> &paths)
+{
+	QEvent::Type type = (QEvent::Type) rec->eventType;
+	QByteArray path;
+	const char *name;
+
+	if (rec->pathId == 0)
+		path = "-";
+	else if (paths.contains(rec->pathId))
+		path = paths.value(rec->pathId);
+	else
+		path = "#" + QByteArray::number(rec->pathId);
+
+	if ((name = eventTypeName(type)) == NULL)
+		name = "?";
+
+	printf("%8llu %4u.%06u %-20s %s",
+			(unsigned long long) rec->seq,
+			(unsigned int) (rec->usec / 1000000), (unsigned int) (rec->usec % 1000000),
+			name, path.constData());
+
+	switch (type) {
+	case QEvent::MouseButtonPress:
+	case QEvent::MouseButtonRelease:
+	case QEvent::MouseButtonDblClick:
+	case QEvent::MouseMove:
+		printf(" x=%d y=%d button=%s modifiers=%s",
+				rec->x, rec->y,
+				buttonToString((Qt::MouseButton) rec->button),
+				keyboardModifiersToString((Qt::KeyboardModifiers) rec->modifiers));
+		break;
+
+	case QEvent::KeyPress:
+	case QEvent::KeyRelease:
+		printf(" key=%s modifiers=%s text=\"%.*s\"",
+				keyToString(rec->key),
+				keyboardModifiersToString((Qt::KeyboardModifiers) rec->modifiers),
+				(int) rec->payload, compactPayload(rec));
+		break;
+
+	default: ;
+	}
+
+	printf("\n");
+}
+
+struct Reader {
+	QHash<uint32_t, QByteArray> paths;
+	unsigned long long	events, lost;
+	uint64_t		expect;
+	bool			quiet;
+
+	Reader()
+	: events(0), lost(0), expect((uint64_t) -1), quiet(false) { }
+
+	void			process(const CompactRecord *, bool checkSequence);
+};
+
+void
+Reader::process(const CompactRecord *rec, bool checkSequence)
+{
+	if (rec->kind == CompactPad)
+		return;
+
+	if (checkSequence) {
+		if (expect != (uint64_t) -1 && rec->seq != expect) {
+			lost += rec->seq - expect;
+			if (!quiet)
+				printf("=== lost %llu records\n", (unsigned long long) (rec->seq - expect));
+		}
+		expect = rec->seq + 1;
+	}
+
+	if (rec->kind == CompactPath) {
+		paths.insert(rec->pathId, QByteArray(compactPayload(rec), rec->payload));
+	} else
+	if (rec->kind == CompactEvent) {
+		events++;
+		if (!quiet)
+			printEvent(rec, paths);
+	}
+}
+
+static bool
+validRecord(const CompactRecord *rec, unsigned int size)
+{
+	if (rec->kind == CompactPad)
+		return true;
+	return size >= sizeof(CompactRecord) && rec->payload <= size - sizeof(CompactRecord);
+}
+
+/*
+ * Follow a live ring until the application closes it
+ */
+static int
+readRing(ExportRingHeader *ring, Reader &reader)
+{
+	uint64_t capacity = ring->capacity, pos;
+	char *data = (char *) (ring + 1);
+
+	pos = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	while (true) {
+		union {
+			CompactRecord rec;
+			char buffer[sizeof(CompactRecord) + COMPACT_MAX_PAYLOAD + 8];
+		} u;
+		uint64_t head, oldest;
+		unsigned int size;
+
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		if (pos == head) {
+			if (__atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE)
+			 && __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == pos)
+				break;
+			usleep(1000);
+			continue;
+		}
+
+		// With the overwrite policy, the producer may have lapped us
+		if (ring->policy == EventExporter::PolicyOverwrite
+		 && pos < (oldest = __atomic_load_n(&ring->oldest, __ATOMIC_ACQUIRE)))
+			pos = oldest;
+
+		memcpy(&u.rec, data + pos % capacity, sizeof(u.rec.size));
+		size = u.rec.size;
+		if (size >= 8 && size <= sizeof(u.buffer) && pos % capacity + size <= capacity)
+			memcpy(u.buffer, data + pos % capacity, size);
+		else
+			size = 0;
+
+		if (size == 0 || !validRecord(&u.rec, size)) {
+			// Only a torn read can get us here
+			if (ring->policy == EventExporter::PolicyOverwrite)
+				continue;
+			fprintf(stderr, "Corrupt record at offset %llu\n", (unsigned long long) pos);
+			return 1;
+		}
+
+		if (ring->policy == EventExporter::PolicyOverwrite) {
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (pos < __atomic_load_n(&ring->oldest, __ATOMIC_RELAXED))
+				continue;
+		}
+
+		pos += size;
+		__atomic_store_n(&ring->tail, pos, __ATOMIC_RELEASE);
+
+		reader.process(&u.rec, true);
+	}
+
+	return 0;
+}
+
+/*
+ * Read a flight recorder dump
+ */
+static int
+readDump(const char *path, Reader &reader)
+{
+	QFile file(QFile::decodeName(path));
+	QByteArray data;
+	int pos = 0;
+
+	if (!file.open(QIODevice::ReadOnly)) {
+		perror(path);
+		return 1;
+	}
+	data = file.readAll();
+
+	while (pos + (int) sizeof(CompactRecord) <= data.size()) {
+		const CompactRecord *rec = (const CompactRecord *) (data.constData() + pos);
+
+		if (rec->size < sizeof(CompactRecord) || pos + rec->size > data.size()
+		 || !validRecord(rec, rec->size)) {
+			fprintf(stderr, "%s: corrupt record at offset %d\n", path, pos);
+			return 1;
+		}
+
+		// A dump holds whatever was recent, so gaps are expected
+		reader.process(rec, false);
+		pos += rec->size;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	ExportRingHeader *ring;
+	Reader reader;
+	int c, rv;
+
+	while ((c = getopt(argc, argv, "hn")) != -1) {
+		switch (c) {
+		case 'n':
+			reader.quiet = true;
+			break;
+		case 'h':
+			usage(0);
+		default:
+			usage(1);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(1);
+
+	if ((ring = attach(argv[optind])) != 0)
+		rv = readRing(ring, reader);
+	else
+		rv = readDump(argv[optind], reader);
+
+	printf("=== %llu events, %llu records lost, %u object paths\n",
+			reader.events, reader.lost, reader.paths.count());
+	return rv;
+}
@@ -0,0 +1,92 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Event statistics
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qobject.h>
+#include <qlist.h>
+#include <qpair.h>
+
+#include <string.h>
+#include <algorithm>
+#include "eventstats.h"
+#include "pathtable.h"
+#include "namespace.h"
+#include "puppeteer.h"
+
+typedef QPair<quint64, int>	Entry;	// count, index
+
+EventStats::EventStats(PathTable *paths)
+: mTotal(0), mLastTotal(0), mPaths(paths)
+{
+	memset(mByType, 0, sizeof(mByType));
+	mByPath.resize(1024);
+
+	mStarted = mLastDump = Puppeteer::timestampUsec();
+}
+
+static bool
+busiestFirst(const Entry &a, const Entry &b)
+{
+	return a.first > b.first;
+}
+
+static void
+keepTop(QList<Entry> &list, unsigned int top)
+{
+	std::sort(list.begin(), list.end(), busiestFirst);
+	while ((unsigned int) list.count() > top)
+		list.removeLast();
+}
+
+void
+EventStats::dump(FILE *fp, unsigned int top)
+{
+	quint64 now = Puppeteer::timestampUsec();
+	double interval = (now - mLastDump) / 1e6;
+	QList<Entry> types, paths;
+	QList<QPair<quint64, const QMetaObject *> > classes;
+
+	fprintf(fp, "=== Event statistics after %.1f sec: %llu events, %.1f per sec over the last %.1f sec\n",
+			(now - mStarted) / 1e6, (unsigned long long) mTotal,
+			interval > 0? (mTotal - mLastTotal) / interval : 0.0, interval);
+
+	mLastDump = now;
+	mLastTotal = mTotal;
+	if (mTotal == 0)
+		return;
+
+	for (int i = 0; i <= UserTypes; ++i) {
+		if (mByType[i])
+			types.append(Entry(mByType[i], i));
+	}
+	keepTop(types, top);
+
+	fprintf(fp, "===   By type:\n");
+	for (int i = 0; i < types.count(); ++i)
+		fprintf(fp, "===   %12llu  %s\n", (unsigned long long) types[i].first,
+				types[i].second < UserTypes? eventTypeName((QEvent::Type) types[i].second) : "(user defined)");
+
+	for (int i = 0; i < mByPath.count(); ++i) {
+		if (mByPath[i])
+			paths.append(Entry(mByPath[i], i));
+	}
+	keepTop(paths, top);
+
+	fprintf(fp, "===   By object:\n");
+	for (int i = 0; i < paths.count(); ++i)
+		fprintf(fp, "===   %12llu  %s\n", (unsigned long long) paths[i].first,
+				paths[i].second? qPrintable(mPaths->path(paths[i].second)) : "(no path)");
+
+	for (QHash<const QMetaObject *, quint64>::const_iterator it = mByClass.begin(); it != mByClass.end(); ++it)
+		classes.append(qMakePair(it.value(), it.key()));
+	std::sort(classes.begin(), classes.end());
+	std::reverse(classes.begin(), classes.end());
+
+	fprintf(fp, "===   By class:\n");
+	for (int i = 0; i < classes.count() && (unsigned int) i < top; ++i)
+		fprintf(fp, "===   %12llu  %s\n", (unsigned long long) classes[i].first,
+				classes[i].second->className());
+	fflush(fp);
+}
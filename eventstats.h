@@ -0,0 +1,56 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Event statistics
+//
+//	For when we only want to know what the event traffic looks
+//	like. Every event bumps a few counters: one per event type,
+//	in a fixed table, one per interned object path, and one per
+//	receiver class. No event records are built, so this is
+//	cheap enough to leave on in long sessions.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_EVENTSTATS_H
+#define PUPPETEER_EVENTSTATS_H
+
+#include <qevent.h>
+#include <qhash.h>
+#include <qvector.h>
+#include <stdio.h>
+
+class PathTable;
+
+class EventStats {
+public:
+	EventStats(PathTable *paths);
+
+	void			count(QEvent::Type type, quint32 pathId, const QMetaObject *meta)
+				{
+					mTotal++;
+					mByType[type < UserTypes? type : UserTypes]++;
+					if (pathId >= (quint32) mByPath.size())
+						mByPath.resize(pathId + 1024);
+					mByPath[pathId]++;
+					mByClass[meta]++;
+				}
+
+	// Print the busiest types, objects and classes, and reset the interval
+	void			dump(FILE *, unsigned int top);
+
+private:
+	// All user defined event types share the last slot
+	enum { UserTypes = QEvent::User };
+
+	quint64			mTotal;
+	quint64			mLastTotal;
+	quint64			mStarted;
+	quint64			mLastDump;
+
+	quint64			mByType[UserTypes + 1];
+	QVector<quint64>	mByPath;
+	QHash<const QMetaObject *, quint64> mByClass;
+
+	PathTable *		mPaths;
+};
+
+#endif /* PUPPETEER_EVENTSTATS_H */
@@ -0,0 +1,168 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Flight recorder
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qfile.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include "flightrecorder.h"
+#include "pathtable.h"
+#include "puppeteer.h"
+
+static FlightRecorder *	theRecorder;
+
+FlightRecorder::FlightRecorder(PathTable *paths, const QString &filename,
+				unsigned int maxEvents, quint64 maxAge)
+: mPaths(paths), mCount(maxEvents), mNext(0), mMaxAge(maxAge)
+{
+	// Signal handlers cannot convert QStrings
+	mFilename = strdup(QFile::encodeName(filename));
+
+	if (mCount == 0)
+		mCount = 1;
+	mSlots = new Slot[mCount];
+}
+
+FlightRecorder::~FlightRecorder()
+{
+	if (theRecorder == this)
+		theRecorder = 0;
+	delete[] mSlots;
+	free(mFilename);
+}
+
+void
+FlightRecorder::recordEvent(quint32 pathId, QEvent *event)
+{
+	Slot *slot = &mSlots[mNext % mCount];
+
+	memset(&slot->rec, 0, sizeof(slot->rec));
+	slot->rec.kind = CompactEvent;
+	slot->rec.pathId = pathId;
+	slot->rec.seq = mNext++;
+	slot->rec.usec = Puppeteer::timestampUsec();
+	compactFillEvent(&slot->rec, event);
+
+	if (event->type() == QEvent::KeyPress || event->type() == QEvent::KeyRelease) {
+		QByteArray utf8 = compactEventText(event).left(TextSize);
+
+		memcpy(slot->text, utf8.constData(), utf8.size());
+		slot->rec.payload = utf8.size();
+	}
+}
+
+static bool
+writeAll(int fd, const void *data, size_t len)
+{
+	const char *p = (const char *) data;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+static bool
+writeRecord(int fd, CompactRecord *rec, const char *payload)
+{
+	static const char zeroes[8] = { 0 };
+	unsigned int pad;
+
+	rec->size = compactRecordSize(rec->payload);
+	pad = rec->size - sizeof(*rec) - rec->payload;
+
+	return writeAll(fd, rec, sizeof(*rec))
+	    && writeAll(fd, payload, rec->payload)
+	    && writeAll(fd, zeroes, pad);
+}
+
+bool
+FlightRecorder::dump()
+{
+	quint64 first = 0, newest;
+	bool ok = true;
+	int fd;
+
+	if ((fd = open(mFilename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return false;
+
+	for (quint32 id = 1; ok && id <= mPaths->utf8Count(); ++id) {
+		const char *path = mPaths->utf8(id);
+		size_t length = strlen(path);
+		CompactRecord rec;
+
+		memset(&rec, 0, sizeof(rec));
+		rec.kind = CompactPath;
+		rec.pathId = id;
+		rec.payload = length < COMPACT_MAX_PAYLOAD? length : COMPACT_MAX_PAYLOAD;
+		ok = writeRecord(fd, &rec, path);
+	}
+
+	if (mNext > mCount)
+		first = mNext - mCount;
+
+	if (mMaxAge && mNext > 0) {
+		newest = mSlots[(mNext - 1) % mCount].rec.usec;
+		while (first < mNext && mSlots[first % mCount].rec.usec + mMaxAge < newest)
+			first++;
+	}
+
+	for (quint64 n = first; ok && n < mNext; ++n) {
+		Slot slot = mSlots[n % mCount];
+
+		ok = writeRecord(fd, &slot.rec, slot.text);
+	}
+
+	close(fd);
+	return ok;
+}
+
+static void
+flightRecorderSignal(int sig)
+{
+	static const char msg[] = "=== Flight recorder written\n";
+	int saved = errno;
+
+	if (theRecorder && theRecorder->dump())
+		write(2, msg, sizeof(msg) - 1);
+
+	if (sig != SIGUSR2) {
+		// SA_RESETHAND restored the default action; die of it
+		raise(sig);
+	}
+	errno = saved;
+}
+
+void
+FlightRecorder::installSignalHandlers()
+{
+	static const int fatal[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, 0 };
+	struct sigaction sa;
+
+	theRecorder = this;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = flightRecorderSignal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &sa, NULL);
+
+	sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+	for (const int *sig = fatal; *sig; ++sig)
+		sigaction(*sig, &sa, NULL);
+}
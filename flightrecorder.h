@@ -0,0 +1,59 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Flight recorder
+//
+//	Keeps the most recent events in memory, as compact records
+//	in a fixed array of slots, and writes them out when
+//	something goes wrong. Recording an event is nothing but
+//	filling in one slot; all the work happens when dumping.
+//
+//	Dumps use the same record format as the event export,
+//	starting with path definitions for all known object
+//	paths, and can be read with puppeteer-events.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_FLIGHTRECORDER_H
+#define PUPPETEER_FLIGHTRECORDER_H
+
+#include <qstring.h>
+
+#include "compact.h"
+
+class PathTable;
+
+class FlightRecorder {
+public:
+	// Keep the last maxEvents, and none older than maxAge usec (unless 0)
+	FlightRecorder(PathTable *paths, const QString &filename,
+			unsigned int maxEvents, quint64 maxAge = 0);
+	~FlightRecorder();
+
+	void			recordEvent(quint32 pathId, QEvent *);
+
+	// These use nothing but async signal safe calls,
+	// so they can be called from a signal handler
+	bool			dump();
+	const char *		filename() const { return mFilename; }
+
+	// Dump on SIGUSR2, and before dying of SIGSEGV and friends
+	void			installSignalHandlers();
+
+private:
+	// Room for the text of a key event, at least
+	enum { TextSize = 24 };
+
+	struct Slot {
+		CompactRecord	rec;
+		char		text[TextSize];
+	};
+
+	PathTable *		mPaths;
+	char *			mFilename;
+	Slot *			mSlots;
+	unsigned int		mCount;
+	quint64			mNext;
+	quint64			mMaxAge;
+};
+
+#endif /* PUPPETEER_FLIGHTRECORDER_H */
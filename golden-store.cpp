@@ -0,0 +1,95 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Maintenance of the golden image store
+//
+//	puppeteer-golden [-s store] list
+//	puppeteer-golden [-s store] prune [-n]
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qdiriterator.h>
+#include <qdir.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "goldenstore.h"
+
+static void
+usage(int exitval)
+{
+	fprintf(stderr,
+		"Usage: puppeteer-golden [-s store] command\n"
+		"Commands:\n"
+		"  list          show all references and the images they point to\n"
+		"  prune [-n]    remove images no longer referenced; -n only shows what would be removed\n"
+		"The default store is $PUPPETEER_GOLDEN_STORE, or ./goldens\n");
+	exit(exitval);
+}
+
+static int
+doList(GoldenStore &store)
+{
+	QString refDir = store.directory() + "/refs";
+	QDirIterator refs(refDir, QDir::Files, QDirIterator::Subdirectories);
+
+	while (refs.hasNext()) {
+		QString ref = refs.next().mid(refDir.length() + 1);
+		QString id;
+
+		if (!store.lookup(ref, id)) {
+			printf("%-40s (unreadable)\n", qPrintable(ref));
+			continue;
+		}
+
+		printf("%-40s %s%s\n", qPrintable(ref), qPrintable(id),
+				QFile::exists(store.objectFile(id))? "" : " (missing)");
+	}
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	QString directory = GoldenStore::defaultDirectory();
+	bool dryRun = false;
+	const char *command;
+	int c;
+
+	while ((c = getopt(argc, argv, "+hs:")) != -1) {
+		switch (c) {
+		case 's':
+			directory = QFile::decodeName(optarg);
+			break;
+		case 'h':
+			usage(0);
+		default:
+			usage(1);
+		}
+	}
+
+	if (optind >= argc)
+		usage(1);
+	command = argv[optind++];
+
+	GoldenStore store(directory);
+
+	if (!strcmp(command, "list"))
+		return doList(store);
+
+	if (!strcmp(command, "prune")) {
+		for (; optind < argc; ++optind) {
+			if (strcmp(argv[optind], "-n"))
+				usage(1);
+			dryRun = true;
+		}
+
+		printf("%u images %s\n", store.prune(dryRun), dryRun? "unreferenced" : "removed");
+		return 0;
+	}
+
+	fprintf(stderr, "Unknown command \"%s\"\n", command);
+	usage(1);
+	return 1;
+}
@@ -0,0 +1,265 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Content-addressed store for golden images
+//
+//	Checksumming uses CRC32C, which current x86 CPUs compute
+//	in hardware (SSE4.2) at several GB/s. This makes hashing a
+//	capture a lot cheaper than decoding a PNG, so a capture
+//	that is bit-identical to its golden never needs the latter.
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qdir.h>
+#include <qfile.h>
+#include <qfileinfo.h>
+#include <qdiriterator.h>
+#include <qset.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "goldenstore.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define HAVE_X86_CRC32
+#endif
+
+/*
+ * CRC32C (Castagnoli), reflected polynomial 0x82F63B78
+ */
+typedef quint32		(*CrcFunc)(quint32, const unsigned char *, unsigned long);
+
+static quint32		crcTable[256];
+
+static quint32
+crc32cSoftware(quint32 crc, const unsigned char *p, unsigned long len)
+{
+	while (len--)
+		crc = crcTable[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+#ifdef HAVE_X86_CRC32
+__attribute__((target("sse4.2")))
+static quint32
+crc32cSSE42(quint32 crc, const unsigned char *p, unsigned long len)
+{
+#ifdef __x86_64__
+	quint64 crc64 = crc;
+
+	while (len >= 8) {
+		quint64 v;
+
+		memcpy(&v, p, 8);
+		crc64 = _mm_crc32_u64(crc64, v);
+		p += 8;
+		len -= 8;
+	}
+	crc = (quint32) crc64;
+#endif
+	while (len >= 4) {
+		quint32 v;
+
+		memcpy(&v, p, 4);
+		crc = _mm_crc32_u32(crc, v);
+		p += 4;
+		len -= 4;
+	}
+	while (len--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+#endif
+
+static CrcFunc
+crcImplementation()
+{
+	static CrcFunc impl;
+
+	if (impl)
+		return impl;
+
+#ifdef HAVE_X86_CRC32
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")) {
+		impl = crc32cSSE42;
+		return impl;
+	}
+#endif
+
+	for (quint32 i = 0; i < 256; ++i) {
+		quint32 c = i;
+
+		for (int k = 0; k < 8; ++k)
+			c = (c & 1)? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+		crcTable[i] = c;
+	}
+
+	impl = crc32cSoftware;
+	return impl;
+}
+
+quint32
+crc32c(quint32 crc, const void *data, unsigned long len)
+{
+	return ~crcImplementation()(~crc, (const unsigned char *) data, len);
+}
+
+/*
+ * Write a file under a temporary name and rename it into place, so that
+ * several test runs sharing a store never see half-written files.
+ */
+static bool
+replaceFile(const QString &path, const QImage *image, const QByteArray &data)
+{
+	QString tmpPath = QString("%1.tmp.%2").arg(path).arg(getpid());
+
+	if (image) {
+		if (!image->save(tmpPath, "PNG"))
+			return false;
+	} else {
+		QFile file(tmpPath);
+
+		if (!file.open(QIODevice::WriteOnly)
+		 || file.write(data) != data.size()) {
+			file.remove();
+			return false;
+		}
+		file.close();
+	}
+
+	if (rename(QFile::encodeName(tmpPath), QFile::encodeName(path)) < 0) {
+		perror(qPrintable(path));
+		QFile::remove(tmpPath);
+		return false;
+	}
+	return true;
+}
+
+GoldenStore::GoldenStore(const QString &directory)
+: mDirectory(directory)
+{
+}
+
+QString
+GoldenStore::defaultDirectory()
+{
+	const char *dir;
+
+	if ((dir = getenv("PUPPETEER_GOLDEN_STORE")) != NULL)
+		return QFile::decodeName(dir);
+	return "goldens";
+}
+
+QString
+GoldenStore::imageId(const QImage &image)
+{
+	quint32 crc = 0;
+	QString id;
+
+	// Skip the scanline padding, it's not part of the image
+	for (int y = 0; y < image.height(); ++y)
+		crc = crc32c(crc, image.scanLine(y), image.width() * 4);
+
+	id.sprintf("%08x-%dx%d", crc, image.width(), image.height());
+	return id;
+}
+
+QString
+GoldenStore::objectFile(const QString &id) const
+{
+	return mDirectory + "/objects/" + id + ".png";
+}
+
+QString
+GoldenStore::refFile(const QString &ref) const
+{
+	return mDirectory + "/refs/" + ref;
+}
+
+bool
+GoldenStore::lookup(const QString &ref, QString &id) const
+{
+	QFile file(refFile(ref));
+
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	id = QString::fromAscii(file.readLine()).trimmed();
+	return !id.isEmpty();
+}
+
+bool
+GoldenStore::add(const QString &ref, const QImage &image, QString &id)
+{
+	QString objPath = objectFile(id);
+	QString path = refFile(ref);
+	QString checksumId = id;
+
+	if (!QDir().mkpath(QFileInfo(objPath).path())
+	 || !QDir().mkpath(QFileInfo(path).path()))
+		return false;
+
+	// Another script may have stored the very same image already, or
+	// a different one with the same checksum; those get a suffix
+	for (int n = 1; QFile::exists(objPath); ++n) {
+		if (load(id) == image.convertToFormat(QImage::Format_ARGB32))
+			break;
+
+		id = QString("%1-%2").arg(checksumId).arg(n);
+		objPath = objectFile(id);
+	}
+
+	if (!QFile::exists(objPath) && !replaceFile(objPath, &image, QByteArray()))
+		return false;
+
+	return replaceFile(path, 0, id.toAscii() + "\n");
+}
+
+QImage
+GoldenStore::load(const QString &id) const
+{
+	QImage image(objectFile(id));
+
+	if (image.isNull())
+		return image;
+	return image.convertToFormat(QImage::Format_ARGB32);
+}
+
+unsigned int
+GoldenStore::prune(bool dryRun)
+{
+	QSet<QString> referenced;
+	unsigned int count = 0;
+
+	QDirIterator refs(mDirectory + "/refs", QDir::Files, QDirIterator::Subdirectories);
+	while (refs.hasNext()) {
+		QString path = refs.next(), id;
+		QFile file(path);
+
+		if (file.open(QIODevice::ReadOnly)) {
+			id = QString::fromAscii(file.readLine()).trimmed();
+			if (!id.isEmpty())
+				referenced.insert(id);
+		}
+	}
+
+	QDirIterator objects(mDirectory + "/objects", QStringList("*.png"), QDir::Files);
+	while (objects.hasNext()) {
+		QString path = objects.next();
+		QString id = objects.fileInfo().completeBaseName();
+
+		if (referenced.contains(id))
+			continue;
+
+		printf("%s %s\n", dryRun? "would remove" : "removing", qPrintable(path));
+		if (!dryRun && !QFile::remove(path)) {
+			fprintf(stderr, "Unable to remove %s\n", qPrintable(path));
+			continue;
+		}
+		count++;
+	}
+
+	return count;
+}
@@ -0,0 +1,49 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Content-addressed store for golden images
+//
+//	Images live in <store>/objects, named after a CRC32C of their
+//	raw pixels plus their size, and a suffix in the rare case that
+//	two images have the same checksum and size. Scripts refer to them through
+//	named references in <store>/refs, each of which contains the
+//	id of the image it points to. Identical images used by
+//	different scripts are stored only once.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_GOLDENSTORE_H
+#define PUPPETEER_GOLDENSTORE_H
+
+#include <qstring.h>
+#include <qimage.h>
+
+class GoldenStore {
+public:
+	GoldenStore(const QString &directory = defaultDirectory());
+
+	// PUPPETEER_GOLDEN_STORE, or "goldens" in the current directory
+	static QString		defaultDirectory();
+
+	// Image must be in Format_ARGB32 or Format_RGB32
+	static QString		imageId(const QImage &);
+
+	const QString &		directory() const { return mDirectory; }
+	QString			objectFile(const QString &id) const;
+	QString			refFile(const QString &ref) const;
+
+	bool			lookup(const QString &ref, QString &id) const;
+	// Sets id to the one the image was stored under, which has a
+	// suffix if a different image has the same checksum
+	bool			add(const QString &ref, const QImage &, QString &id);
+	QImage			load(const QString &id) const;
+
+	// Remove all objects no ref points to; returns the number of objects removed
+	unsigned int		prune(bool dryRun = false);
+
+private:
+	QString			mDirectory;
+};
+
+extern quint32		crc32c(quint32 crc, const void *data, unsigned long len);
+
+#endif /* PUPPETEER_GOLDENSTORE_H */
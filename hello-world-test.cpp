@@ -0,0 +1,46 @@
+//////////////////////////////////////////////////////////////////
+//
+//	C++ tests for the hello-world example
+//
+//	PUPPETEER_TEST=all ./hello-world
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qwidget.h>
+
+#include "testcase.h"
+
+#ifdef __cpp_impl_coroutine
+
+PUPPETEER_TEST(terribleMorning)
+{
+	QWidget *combo = widget("mainWindow.*.morningCombo");
+
+	setFocus(combo);
+	key(combo, Qt::Key_Home);
+	key(combo, Qt::Key_Down);
+	co_await waitProperty("mainWindow.*.helloLabel", "text", "Hello world. What a terrible morning.");
+}
+
+PUPPETEER_TEST(otherMorning)
+{
+	QWidget *combo = widget("mainWindow.*.morningCombo");
+	QWidget *edit = widget("mainWindow.*.morningEdit");
+
+	setFocus(combo);
+	key(combo, Qt::Key_End);
+	if (!verify(edit, "enabled", "true"))
+		co_return;
+
+	// Set up before typing, which sends the signal before it returns
+	TestCase::Wait edited = waitSignal(edit, SIGNAL(editingFinished()));
+
+	setFocus(edit);
+	key(edit, Qt::Key_A, Qt::ControlModifier);
+	typeText(edit, "glorious\n");
+	co_await edited;
+
+	verify("mainWindow.*.helloLabel", "text", "Hello world. What a glorious morning.");
+}
+
+#endif /* __cpp_impl_coroutine */
@@ -53,6 +53,13 @@ HelloWorld::HelloWorld()
 	connect(mMorningTypeEdit, SIGNAL(editingFinished()), SLOT(morningTypeEdited()));
 	layout2->addWidget(mMorningTypeEdit);
 
+	// A line edit without a name, as many are, for scripts/type-unnamed.xml
+	QFrame *notes = new QFrame(frame);
+	notes->setObjectName("notesFrame");
+	notes->setLayout(new QHBoxLayout);
+	notes->layout()->addWidget(new QLineEdit(notes));
+	layout1->addWidget(notes);
+
 	layout2 = new QHBoxLayout;
 	layout1->addLayout(layout2);
 
@@ -130,6 +137,8 @@ main(int argc, char **argv)
 	QApplication *app;
 	HelloWorld *main;
 
+	Puppeteer::zygote();
+
 	app = new QApplication(argc, argv);
 
 	Puppeteer::start();
@@ -0,0 +1,246 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Pixel comparison of widget captures against golden images
+//
+//	The hot loop compares rows of 32bit pixels. We have an SSE2
+//	and an AVX2 version of it, and pick the best one the CPU
+//	supports at run time. The scalar version handles the tail
+//	end of each row, and everything on non-x86 platforms.
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qvector.h>
+#include <qpair.h>
+#include <qalgorithms.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include "imagecompare.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define HAVE_X86_KERNELS
+#endif
+
+typedef unsigned int	(*DiffRowFunc)(const quint32 *, const quint32 *, unsigned int, unsigned int);
+
+static unsigned int
+diffRowScalar(const quint32 *a, const quint32 *b, unsigned int count, unsigned int tolerance)
+{
+	unsigned int i, shift, ndiff = 0;
+
+	for (i = 0; i < count; ++i) {
+		quint32 pa = a[i], pb = b[i];
+
+		if (pa == pb)
+			continue;
+
+		for (shift = 0; shift < 32; shift += 8) {
+			int ca = (pa >> shift) & 0xff;
+			int cb = (pb >> shift) & 0xff;
+
+			if ((unsigned int) abs(ca - cb) > tolerance) {
+				ndiff++;
+				break;
+			}
+		}
+	}
+
+	return ndiff;
+}
+
+#ifdef HAVE_X86_KERNELS
+/*
+ * |a - b| per byte is subs(a, b) | subs(b, a), as one of the two always
+ * saturates to 0. Subtracting the tolerance leaves a non-zero byte
+ * wherever a channel is out of range; a 32bit compare against zero
+ * then gives us one mask bit per pixel.
+ */
+__attribute__((target("sse2")))
+static unsigned int
+diffRowSSE2(const quint32 *a, const quint32 *b, unsigned int count, unsigned int tolerance)
+{
+	const __m128i tol = _mm_set1_epi8((char) tolerance);
+	const __m128i zero = _mm_setzero_si128();
+	unsigned int i = 0, ndiff = 0;
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i va = _mm_loadu_si128((const __m128i *) (a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *) (b + i));
+		__m128i delta = _mm_or_si128(_mm_subs_epu8(va, vb), _mm_subs_epu8(vb, va));
+		__m128i same = _mm_cmpeq_epi32(_mm_subs_epu8(delta, tol), zero);
+
+		ndiff += 4 - __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(same)));
+	}
+
+	return ndiff + diffRowScalar(a + i, b + i, count - i, tolerance);
+}
+
+__attribute__((target("avx2")))
+static unsigned int
+diffRowAVX2(const quint32 *a, const quint32 *b, unsigned int count, unsigned int tolerance)
+{
+	const __m256i tol = _mm256_set1_epi8((char) tolerance);
+	const __m256i zero = _mm256_setzero_si256();
+	unsigned int i = 0, ndiff = 0;
+
+	for (; i + 8 <= count; i += 8) {
+		__m256i va = _mm256_loadu_si256((const __m256i *) (a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *) (b + i));
+		__m256i delta = _mm256_or_si256(_mm256_subs_epu8(va, vb), _mm256_subs_epu8(vb, va));
+		__m256i same = _mm256_cmpeq_epi32(_mm256_subs_epu8(delta, tol), zero);
+
+		ndiff += 8 - __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(same)));
+	}
+
+	return ndiff + diffRowScalar(a + i, b + i, count - i, tolerance);
+}
+#endif
+
+static const char *	diffKernelName;
+
+static DiffRowFunc
+diffKernel()
+{
+	static DiffRowFunc kernel;
+	const char *forced;
+
+	if (kernel)
+		return kernel;
+
+	// PUPPETEER_IMAGE_KERNEL=scalar|sse2 can be used to rule out the SIMD code
+	forced = getenv("PUPPETEER_IMAGE_KERNEL");
+
+	kernel = diffRowScalar;
+	diffKernelName = "scalar";
+#ifdef HAVE_X86_KERNELS
+	__builtin_cpu_init();
+	if (forced && !strcmp(forced, "scalar")) {
+		/* keep scalar */
+	} else
+	if (__builtin_cpu_supports("avx2") && !(forced && !strcmp(forced, "sse2"))) {
+		kernel = diffRowAVX2;
+		diffKernelName = "avx2";
+	} else
+	if (__builtin_cpu_supports("sse2")) {
+		kernel = diffRowSSE2;
+		diffKernelName = "sse2";
+	}
+#endif
+	return kernel;
+}
+
+const char *
+imageCompareKernel()
+{
+	diffKernel();
+	return diffKernelName;
+}
+
+/*
+ * For a given row, compute the spans of pixels not covered by any mask
+ */
+typedef QPair<int, int>	Span;
+
+static void
+unmaskedSpans(int y, int width, const QList<QRect> &masks, QVector<Span> &result)
+{
+	QVector<Span> covered;
+	int x = 0;
+
+	result.clear();
+	for (QList<QRect>::const_iterator it = masks.begin(); it != masks.end(); ++it) {
+		const QRect &m(*it);
+
+		int left, right;
+
+		if (y < m.top() || y > m.bottom())
+			continue;
+
+		// Masks may well run off the edge of the widget
+		left = qBound(0, m.left(), width);
+		right = qBound(0, m.right() + 1, width);
+		if (left < right)
+			covered.append(Span(left, right));
+	}
+
+	qSort(covered);
+	for (QVector<Span>::const_iterator it = covered.begin(); it != covered.end(); ++it) {
+		if (it->first > x)
+			result.append(Span(x, it->first));
+		x = qMax(x, it->second);
+	}
+	if (x < width)
+		result.append(Span(x, width));
+}
+
+unsigned long
+compareImages(const QImage &actual, const QImage &expected, unsigned int tolerance, const QList<QRect> &masks)
+{
+	DiffRowFunc diffRow = diffKernel();
+	int width = actual.width(), height = actual.height();
+	unsigned long ndiff = 0;
+	QVector<Span> spans;
+
+	if (tolerance > 255)
+		tolerance = 255;
+
+	// Without masks and padding, the whole image is one long row
+	if (masks.isEmpty()
+	 && actual.bytesPerLine() == width * 4
+	 && expected.bytesPerLine() == width * 4)
+		return diffRow((const quint32 *) actual.bits(), (const quint32 *) expected.bits(), width * height, tolerance);
+
+	for (int y = 0; y < height; ++y) {
+		const quint32 *a = (const quint32 *) actual.scanLine(y);
+		const quint32 *b = (const quint32 *) expected.scanLine(y);
+
+		if (masks.isEmpty()) {
+			ndiff += diffRow(a, b, width, tolerance);
+			continue;
+		}
+
+		unmaskedSpans(y, width, masks, spans);
+		for (QVector<Span>::const_iterator it = spans.begin(); it != spans.end(); ++it)
+			ndiff += diffRow(a + it->first, b + it->first, it->second - it->first, tolerance);
+	}
+
+	return ndiff;
+}
+
+/*
+ * Only used when a comparison failed, so no need to be fast here.
+ * Differing pixels are shown in red, masked areas in blue, and
+ * everything else as a faded version of the actual image.
+ */
+QImage
+buildDiffImage(const QImage &actual, const QImage &expected, unsigned int tolerance, const QList<QRect> &masks)
+{
+	QImage diff(actual.size(), QImage::Format_ARGB32);
+	int width = actual.width(), height = actual.height();
+	QVector<Span> spans;
+
+	for (int y = 0; y < height; ++y) {
+		const quint32 *a = (const quint32 *) actual.scanLine(y);
+		const quint32 *b = (const quint32 *) expected.scanLine(y);
+		QRgb *out = (QRgb *) diff.scanLine(y);
+
+		for (int x = 0; x < width; ++x)
+			out[x] = qRgb(0x80, 0x80, 0xff);
+
+		unmaskedSpans(y, width, masks, spans);
+		for (QVector<Span>::const_iterator it = spans.begin(); it != spans.end(); ++it) {
+			for (int x = it->first; x < it->second; ++x) {
+				if (diffRowScalar(a + x, b + x, 1, tolerance)) {
+					out[x] = qRgb(0xff, 0, 0);
+				} else {
+					int g = 192 + qGray(a[x]) / 4;
+
+					out[x] = qRgb(g, g, g);
+				}
+			}
+		}
+	}
+
+	return diff;
+}
@@ -0,0 +1,29 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Pixel comparison of widget captures against golden images
+//
+//
+//
+//
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_IMAGECOMPARE_H
+#define PUPPETEER_IMAGECOMPARE_H
+
+#include <qimage.h>
+#include <qlist.h>
+#include <qrect.h>
+
+// Both images must have the same size and be in Format_ARGB32 or Format_RGB32.
+// A pixel differs if any of its channels differs by more than tolerance.
+// Pixels inside any of the masks are ignored.
+extern unsigned long	compareImages(const QImage &actual, const QImage &expected,
+				unsigned int tolerance, const QList<QRect> &masks);
+extern QImage		buildDiffImage(const QImage &actual, const QImage &expected,
+				unsigned int tolerance, const QList<QRect> &masks);
+
+// Name of the comparison kernel selected for this CPU
+extern const char *	imageCompareKernel();
+
+#endif /* PUPPETEER_IMAGECOMPARE_H */
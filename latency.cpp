@@ -0,0 +1,179 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Input to paint latency
+//
+//////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include "latency.h"
+#include "namespace.h"
+#include "puppeteer.h"
+
+LatencyTracker::ClassStats::ClassStats()
+: count(0), unpainted(0), total(0), max(0)
+{
+	for (int i = 0; i < Buckets; ++i)
+		buckets[i] = 0;
+}
+
+LatencyTracker::LatencyTracker()
+{
+}
+
+void
+LatencyTracker::injected(QWidget *receiver, QEvent *event, unsigned int step)
+{
+	Pending p;
+
+	p.event = event;
+	p.type = event->type();
+	p.receiver = receiver;
+	p.window = receiver->window();
+	p.className = receiver->metaObject()->className();
+	p.step = step;
+	p.posted = Puppeteer::timestampUsec();
+	p.delivered = 0;
+	mPending.append(p);
+}
+
+void
+LatencyTracker::observeEvent(QObject *object, QEvent *event)
+{
+	quint64 now;
+	QWidget *window;
+
+	if (mPending.isEmpty())
+		return;
+
+	now = Puppeteer::timestampUsec();
+
+	switch (event->type()) {
+	case QEvent::Paint:
+	case QEvent::UpdateRequest:
+		if (!object->isWidgetType())
+			return;
+
+		window = ((QWidget *) object)->window();
+		for (int i = 0; i < mPending.count(); ) {
+			Pending &p = mPending[i];
+
+			if (p.delivered && (p.window == window || p.window.isNull())) {
+				finish(p, p.window.isNull()? 0 : now);
+				mPending.removeAt(i);
+			} else {
+				++i;
+			}
+		}
+		return;
+
+	default:
+		break;
+	}
+
+	for (int i = 0; i < mPending.count(); ) {
+		Pending &p = mPending[i];
+
+		// Qt deletes the events posted to a receiver that is deleted,
+		// and their memory may be reused by the event we're looking at
+		if (!p.delivered && p.receiver.isNull()) {
+			mPending.removeAt(i);
+			continue;
+		}
+
+		// The first time we see it; it may propagate to the parents later
+		if (!p.delivered && object == p.receiver && event->type() == p.type && p.event == event)
+			p.delivered = now;
+
+		// Nothing was painted, as far as we can tell
+		if (p.delivered && now - p.delivered > NoPaintAfter) {
+			finish(p, 0);
+			mPending.removeAt(i);
+		} else
+		// Never delivered, yet its receiver is still there
+		if (!p.delivered && now - p.posted > NoPaintAfter) {
+			mPending.removeAt(i);
+		} else {
+			++i;
+		}
+	}
+}
+
+int
+LatencyTracker::bucket(quint64 usec)
+{
+	int n = 0;
+
+	for (quint64 limit = 1000; n < Buckets - 1 && usec >= limit; limit <<= 1)
+		n++;
+	return n;
+}
+
+void
+LatencyTracker::finish(const Pending &p, quint64 painted)
+{
+	ClassStats &stats = mStats[p.className];
+	quint64 latency;
+
+	stats.count++;
+	if (!painted) {
+		printf("=== Latency step %u (%s to %s): delivered after %.1f msec, no repaint\n",
+				p.step, eventTypeName(p.type), qPrintable(p.className),
+				(p.delivered - p.posted) / 1000.0);
+		stats.unpainted++;
+		return;
+	}
+
+	latency = painted - p.posted;
+	printf("=== Latency step %u (%s to %s): delivered after %.1f msec, painted after %.1f msec\n",
+			p.step, eventTypeName(p.type), qPrintable(p.className),
+			(p.delivered - p.posted) / 1000.0, latency / 1000.0);
+
+	stats.total += latency;
+	if (latency > stats.max)
+		stats.max = latency;
+	stats.buckets[bucket(latency)]++;
+}
+
+void
+LatencyTracker::report()
+{
+	// Whatever is still waiting for a paint won't get one now
+	while (!mPending.isEmpty()) {
+		Pending p = mPending.takeFirst();
+
+		if (p.delivered)
+			finish(p, 0);
+	}
+
+	if (mStats.isEmpty())
+		return;
+
+	printf("=== Input to paint latency by widget class, in msec:\n");
+	for (QMap<QString, ClassStats>::const_iterator it = mStats.begin(); it != mStats.end(); ++it) {
+		const ClassStats &stats = it.value();
+		unsigned int painted = stats.count - stats.unpainted;
+		QString line;
+
+		line.sprintf("===   %-24s %4u events", qPrintable(it.key()), stats.count);
+		if (painted)
+			line += QString().sprintf(", mean %.1f, max %.1f",
+					stats.total / 1000.0 / painted, stats.max / 1000.0);
+		if (stats.unpainted)
+			line += QString().sprintf(", %u without repaint", stats.unpainted);
+		printf("%s\n", qPrintable(line));
+
+		if (!painted)
+			continue;
+
+		line = "===     ";
+		for (int i = 0; i < Buckets; ++i) {
+			if (!stats.buckets[i])
+				continue;
+			if (i < Buckets - 1)
+				line += QString().sprintf(" <%d:%u", 1 << i, stats.buckets[i]);
+			else
+				line += QString().sprintf(" >=%d:%u", 1 << (i - 1), stats.buckets[i]);
+		}
+		printf("%s\n", qPrintable(line));
+	}
+}
@@ -0,0 +1,67 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Input to paint latency
+//
+//	Every event we inject is timed from the moment it is
+//	posted, through its delivery to the receiver, to the first
+//	paint of the receiver's window after that. Figures are
+//	printed per step as they come in, and collected in a
+//	histogram per widget class for the report at the end.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_LATENCY_H
+#define PUPPETEER_LATENCY_H
+
+#include <qpointer.h>
+#include <qwidget.h>
+#include <qevent.h>
+#include <qstring.h>
+#include <qlist.h>
+#include <qmap.h>
+
+class LatencyTracker {
+public:
+	LatencyTracker();
+
+	// Call right before posting or sending the event
+	void			injected(QWidget *receiver, QEvent *, unsigned int step);
+
+	// Called from the event filter
+	void			observeEvent(QObject *, QEvent *);
+
+	void			report();
+
+private:
+	// Histogram buckets are powers of two, in msec
+	enum { Buckets = 11, NoPaintAfter = 2000000 };
+
+	struct Pending {
+		const QEvent *		event;		// only valid while receiver is
+		QEvent::Type		type;
+		QPointer<QWidget>	receiver;
+		QPointer<QWidget>	window;
+		QString			className;
+		unsigned int		step;
+		quint64			posted;
+		quint64			delivered;	// 0 until delivered
+	};
+
+	struct ClassStats {
+		ClassStats();
+
+		unsigned int		count;
+		unsigned int		unpainted;
+		quint64			total;		// usec
+		quint64			max;
+		unsigned int		buckets[Buckets];
+	};
+
+	void			finish(const Pending &, quint64 painted);
+	static int		bucket(quint64 usec);
+
+	QList<Pending>		mPending;
+	QMap<QString, ClassStats> mStats;
+};
+
+#endif /* PUPPETEER_LATENCY_H */
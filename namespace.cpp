@@ -16,8 +16,10 @@
 #include <qevent.h>
 #include <qmenu.h>
 #include <qmenubar.h>
+#include <qstringlist.h>
 
 #include <stdio.h>
+#include <string.h>
 
 
 static const char *
@@ -364,6 +366,7 @@ static BitmaskMapping keyMap[] = {
 #endif
         { Qt::Key_ydiaeresis, "ydiaeresis" },
 
+	{ 0, NULL }
 };
 
 const char *
@@ -372,6 +375,24 @@ keyboardModifiersToString(Qt::KeyboardModifiers modifiers)
 	return bitmaskToString(modifiers, modifierMap);
 }
 
+Qt::KeyboardModifiers
+keyboardModifiersFromString(const QString &string)
+{
+	QStringList names = string.split(',', QString::SkipEmptyParts);
+	Qt::KeyboardModifiers modifiers = Qt::NoModifier;
+
+	for (QStringList::const_iterator it = names.begin(); it != names.end(); ++it) {
+		unsigned long value;
+
+		if (!enumFromString(it->trimmed(), modifierMap, &value)) {
+			fprintf(stderr, "Unknown keyboard modifier \"%s\"\n", qPrintable(*it));
+			continue;
+		}
+		modifiers |= (Qt::KeyboardModifier) value;
+	}
+	return modifiers;
+}
+
 const char *
 buttonMaskToString(Qt::MouseButtons buttons)
 {
@@ -410,6 +431,46 @@ keyFromString(const QString &string)
 	return (Qt::Key) value;
 }
 
+/*
+ * Find the key that produces a character, as on a US keyboard. For
+ * Latin-1 characters, the Qt key code is the upper case character, as
+ * long as that is in Latin-1 too. Returns false for anything
+ * that cannot be typed directly.
+ */
+bool
+keyForCharacter(QChar c, int *key, Qt::KeyboardModifiers *modifiers)
+{
+	static const char shifted[] = "~!@#$%^&*()_+{}|:\"<>?";
+	ushort u = c.unicode();
+
+	*modifiers = Qt::NoModifier;
+
+	switch (u) {
+	case '\n':
+	case '\r':
+		*key = Qt::Key_Return;
+		return true;
+	case '\t':
+		*key = Qt::Key_Tab;
+		return true;
+	case '\b':
+		*key = Qt::Key_Backspace;
+		return true;
+	}
+
+	if (u < 0x20 || u == 0x7f || u > 0xff)
+		return false;
+
+	// The upper case of a few Latin-1 characters, like µ and ÿ, is
+	// outside Latin-1, and so not a key; their key is the character
+	*key = c.toUpper().unicode();
+	if (*key > 0xff)
+		*key = u;
+	if (c.isUpper() || (u < 0x80 && strchr(shifted, u) != NULL))
+		*modifiers = Qt::ShiftModifier;
+	return true;
+}
+
 static BitmaskMapping	eventMap[] = {
 	{ QEvent::None, "None" },
 	{ QEvent::Timer, "Timer" },
@@ -22,6 +22,7 @@ extern const char *	eventTypeName(QEvent::Type type);
 extern QEvent::Type	eventTypeFromString(const QString &);
 
 extern const char *	keyboardModifiersToString(Qt::KeyboardModifiers modifiers);
+extern Qt::KeyboardModifiers keyboardModifiersFromString(const QString &);
 
 extern const char *	buttonToString(Qt::MouseButton);
 extern Qt::MouseButton	buttonFromString(const QString &);
@@ -31,5 +32,6 @@ extern unsigned long	buttonMaskFromString(const QString &);
 
 extern const char *	keyToString(int key);
 extern Qt::Key		keyFromString(const QString &);
+extern bool		keyForCharacter(QChar, int *key, Qt::KeyboardModifiers *);
 
 #endif // NAMESPACE_H
@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Interning of object paths
+//
+//////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include "pathtable.h"
+
+PathTable::PathTable()
+: mUtf8Count(0)
+{
+	memset(mUtf8, 0, sizeof(mUtf8));
+
+	// Id 0 means "no path"
+	mPaths.append(QString());
+	mUtf8[0] = (const char **) calloc(Utf8ChunkSize, sizeof(const char *));
+	mUtf8[0][0] = strdup("");
+}
+
+PathTable::~PathTable()
+{
+	for (unsigned int id = 0; id <= mUtf8Count; ++id)
+		free((void *) mUtf8[id / Utf8ChunkSize][id % Utf8ChunkSize]);
+	for (int i = 0; i < Utf8Chunks; ++i)
+		free(mUtf8[i]);
+}
+
+quint32
+PathTable::insert(QObject *object, const QString &path)
+{
+	quint32 id;
+
+	if ((id = mIds.value(path)) == 0) {
+		id = mPaths.count();
+		mPaths.append(path);
+		mIds.insert(path, id);
+
+		// Once we run out, later paths go without
+		if (id == mUtf8Count + 1 && id / Utf8ChunkSize < Utf8Chunks) {
+			const char **chunk = mUtf8[id / Utf8ChunkSize];
+
+			if (chunk == 0)
+				chunk = mUtf8[id / Utf8ChunkSize] = (const char **) calloc(Utf8ChunkSize, sizeof(const char *));
+			if (chunk && (chunk[id % Utf8ChunkSize] = strdup(path.toUtf8().constData())) != NULL)
+				__atomic_store_n(&mUtf8Count, id, __ATOMIC_RELEASE);
+		}
+	}
+
+	if (mObjects.contains(object)) {
+		// Renamed, and the paths of its descendants have the old name in them
+		forget(object);
+	}
+
+	connect(object, SIGNAL(destroyed(QObject *)), SLOT(destroyedSlot(QObject *)), Qt::UniqueConnection);
+	mObjects.insert(object, Entry(id, object->objectName()));
+	return id;
+}
+
+void
+PathTable::forget(QObject *object)
+{
+	const QObjectList &children(object->children());
+
+	mObjects.remove(object);
+	for (QObjectList::const_iterator it = children.begin(); it != children.end(); ++it)
+		forget(*it);
+}
+
+void
+PathTable::destroyedSlot(QObject *object)
+{
+	mObjects.remove(object);
+}
@@ -0,0 +1,86 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Interning of object paths
+//
+//	Building an object path walks up the object tree and
+//	allocates strings, which is too slow to do for every
+//	event. The path table remembers the path id of every
+//	object it has seen until that object is destroyed, moved
+//	to another parent, or renamed. Qt doesn't tell anyone
+//	about a new name, so that is noticed when the object is
+//	looked up. Identical paths share the same id, so ids are
+//	stable across objects that come and go, like dialogs.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_PATHTABLE_H
+#define PUPPETEER_PATHTABLE_H
+
+#include <qobject.h>
+#include <qhash.h>
+#include <qvector.h>
+#include <qstring.h>
+#include <qbytearray.h>
+
+class PathTable : public QObject {
+	Q_OBJECT;
+
+public:
+	PathTable();
+	~PathTable();
+
+	// Returns 0 if the object is unknown, or was renamed since
+	quint32			lookup(QObject *object) const
+				{
+					QHash<QObject *, Entry>::const_iterator it = mObjects.find(object);
+
+					if (it == mObjects.end() || it->name != object->objectName())
+						return 0;
+					return it->id;
+				}
+
+	quint32			insert(QObject *object, const QString &path);
+
+	// For an object that moved, whose path and those of its descendants changed
+	void			forget(QObject *object);
+
+	// Ids start at 1
+	const QString &		path(quint32 id) const { return mPaths[id]; }
+	unsigned int		count() const { return mPaths.count() - 1; }
+
+	// These two can be called from a signal handler, even one that
+	// interrupted insert(). Paths past utf8Count() are empty.
+	const char *		utf8(quint32 id) const
+				{
+					if (id > __atomic_load_n(&mUtf8Count, __ATOMIC_ACQUIRE))
+						return "";
+					return mUtf8[id / Utf8ChunkSize][id % Utf8ChunkSize];
+				}
+	unsigned int		utf8Count() const { return __atomic_load_n(&mUtf8Count, __ATOMIC_ACQUIRE); }
+
+private slots:
+	void			destroyedSlot(QObject *);
+
+private:
+	struct Entry {
+		Entry(quint32 i = 0, const QString &n = QString())
+		: id(i), name(n) {}
+
+		quint32		id;
+		QString		name;	// what the path was built with
+	};
+
+	QHash<QObject *, Entry>	mObjects;
+	QHash<QString, quint32>	mIds;
+	QVector<QString>	mPaths;
+
+	// Encoded once, so that crash handlers can write them out. A
+	// QVector may be reallocated under a handler's feet; these are
+	// never moved, and mUtf8Count goes up once an entry is in place.
+	enum { Utf8ChunkSize = 1024, Utf8Chunks = 4096 };
+
+	const char **		mUtf8[Utf8Chunks];
+	unsigned int		mUtf8Count;	// the highest id in mUtf8
+};
+
+#endif /* PUPPETEER_PATHTABLE_H */
@@ -0,0 +1,243 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Performance counters per script step
+//
+//////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+#include "perfcounters.h"
+#include "puppeteer.h"
+
+PerfCounters::PerfCounters()
+: mCount(0), mRusage(false)
+{
+}
+
+PerfCounters::~PerfCounters()
+{
+	for (int i = 0; i < mCount; ++i) {
+		if (mFds[i] >= 0)
+			close(mFds[i]);
+	}
+}
+
+/*
+ * Count for the calling thread, on any CPU. Some kernels only let us
+ * count in user space.
+ */
+bool
+PerfCounters::openCounter(const char *name, unsigned int type, unsigned long long config)
+{
+	struct perf_event_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_hv = 1;
+
+	fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (fd < 0) {
+		attr.exclude_kernel = 1;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	if (fd < 0)
+		return false;
+
+	mFds[mCount] = fd;
+	mNames[mCount] = name;
+	mCount++;
+	return true;
+}
+
+const char *
+PerfCounters::open()
+{
+	bool hardware;
+
+	hardware = openCounter("instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	if (hardware) {
+		openCounter("cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		openCounter("cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	}
+
+	if (openCounter("cpu-time", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK)) {
+		openCounter("context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES);
+		openCounter("page-faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+		return hardware? "hardware and software" : "software";
+	}
+
+	if (hardware)
+		return "hardware";
+
+	// No perf events at all; make do with what the kernel keeps anyway
+	mRusage = true;
+	mNames[0] = "cpu-time";
+	mNames[1] = "context-switches";
+	mNames[2] = "page-faults";
+	for (mCount = 0; mCount < 3; ++mCount)
+		mFds[mCount] = -1;
+	return "getrusage";
+}
+
+void
+PerfCounters::read(quint64 *values) const
+{
+	if (mRusage) {
+		struct rusage ru;
+
+		getrusage(RUSAGE_THREAD, &ru);
+
+		// Same units as the task clock
+		values[0] = ((quint64) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+			  + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000;
+		values[1] = ru.ru_nvcsw + ru.ru_nivcsw;
+		values[2] = ru.ru_minflt + ru.ru_majflt;
+		return;
+	}
+
+	for (int i = 0; i < mCount; ++i) {
+		if (::read(mFds[i], &values[i], sizeof(values[i])) != sizeof(values[i]))
+			values[i] = 0;
+	}
+}
+
+void
+PerfCounters::format(char *buf, size_t size, const char *name, quint64 value)
+{
+	if (!strcmp(name, "cpu-time"))
+		snprintf(buf, size, "%.1fms", value / 1e6);
+	else
+	if (value >= 10000000)
+		snprintf(buf, size, "%.0fM", value / 1e6);
+	else
+	if (value >= 1000000)
+		snprintf(buf, size, "%.1fM", value / 1e6);
+	else
+	if (value >= 10000)
+		snprintf(buf, size, "%.0fK", value / 1e3);
+	else
+		snprintf(buf, size, "%llu", (unsigned long long) value);
+}
+
+void
+Puppeteer::perfStart()
+{
+	const char *what;
+
+	mPerf = new PerfCounters;
+	what = mPerf->open();
+	printf("=== Counting %d performance events per step (%s)\n", mPerf->count(), what);
+
+	perfReset();
+}
+
+/*
+ * Start counting afresh, for a new script
+ */
+void
+Puppeteer::perfReset()
+{
+	mPerfLast.resize(PerfCounters::MaxCounters);
+	mPerf->read(mPerfLast.data());
+}
+
+/*
+ * Charge whatever was counted since the last step to this one
+ */
+void
+Puppeteer::perfStep(const Script::Action *action, const char *status)
+{
+	quint64 now[PerfCounters::MaxCounters];
+	QPair<int, unsigned int> key;
+	PerfStep step;
+	QString line;
+	char buf[32];
+	int index;
+
+	mPerf->read(now);
+
+	step.script = (mSession && mSessionIndex < mSessionScripts.count())? mSessionScripts[mSessionIndex] : QString();
+	step.step = mStep;
+	step.action = action? action->name() : "none";
+	step.status = status;
+	step.delta.resize(mPerf->count());
+	for (int i = 0; i < mPerf->count(); ++i) {
+		step.delta[i] = now[i] - mPerfLast[i];
+		mPerfLast[i] = now[i];
+
+		PerfCounters::format(buf, sizeof(buf), mPerf->name(i), step.delta[i]);
+		line += QString(" %1 %2").arg(mPerf->name(i)).arg(buf);
+	}
+
+	// A soak test would otherwise keep every step of every round
+	key = qMakePair((mSession && mSessionRound > 0)? mSessionIndex % mSessionRound : 0, mStep);
+	if ((index = mPerfStepIndex.value(key, -1)) < 0) {
+		mPerfStepIndex.insert(key, mPerfSteps.count());
+		mPerfSteps.append(step);
+	} else {
+		PerfStep &total(mPerfSteps[index]);
+
+		for (int i = 0; i < mPerf->count(); ++i)
+			total.delta[i] += step.delta[i];
+		if (strcmp(status, "PASS"))
+			total.status = status;
+	}
+
+	printf("=== Perf step %u, %s:%s\n", step.step, step.action, qPrintable(line));
+}
+
+void
+Puppeteer::perfReport()
+{
+	quint64 total[PerfCounters::MaxCounters];
+	QString script;
+	char buf[32];
+
+	if (mPerfSteps.isEmpty())
+		return;
+
+	memset(total, 0, sizeof(total));
+
+	if (mSession && mSessionScripts.count() > mSessionRound)
+		printf("=== Performance counters per step, for all %d rounds:\n", mSessionScripts.count() / mSessionRound);
+	else
+		printf("=== Performance counters per step:\n");
+	printf("===   %-4s %-22s", "step", "action");
+	for (int i = 0; i < mPerf->count(); ++i)
+		printf(" %16s", mPerf->name(i));
+	printf("\n");
+
+	for (int n = 0; n < mPerfSteps.count(); ++n) {
+		const PerfStep &step = mPerfSteps[n];
+
+		if (step.script != script) {
+			script = step.script;
+			printf("===   %s\n", qPrintable(script));
+		}
+
+		printf("===   %-4u %-22s", step.step,
+				qPrintable(QString(step.action) + (strcmp(step.status, "PASS")? QString(" (") + step.status + ")" : "")));
+		for (int i = 0; i < mPerf->count(); ++i) {
+			PerfCounters::format(buf, sizeof(buf), mPerf->name(i), step.delta[i]);
+			printf(" %16s", buf);
+			total[i] += step.delta[i];
+		}
+		printf("\n");
+	}
+
+	printf("===   %-27s", "total");
+	for (int i = 0; i < mPerf->count(); ++i) {
+		PerfCounters::format(buf, sizeof(buf), mPerf->name(i), total[i]);
+		printf(" %16s", buf);
+	}
+	printf("\n");
+}
@@ -0,0 +1,48 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Performance counters per script step
+//
+//	We count what the GUI thread does with perf_event_open():
+//	instructions, cycles and cache misses where the hardware
+//	(and the kernel's perf_event_paranoid setting) allows it,
+//	and CPU time, context switches and page faults in software.
+//	Without perf events at all, getrusage() provides the latter.
+//
+//	Counters are read at every step boundary of a script, and
+//	the difference is charged to the step that just finished.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_PERFCOUNTERS_H
+#define PUPPETEER_PERFCOUNTERS_H
+
+#include <qglobal.h>
+
+class PerfCounters {
+public:
+	enum { MaxCounters = 6 };
+
+	PerfCounters();
+	~PerfCounters();
+
+	// Returns a description of what we got, like "hardware"
+	const char *		open();
+
+	int			count() const { return mCount; }
+	const char *		name(int i) const { return mNames[i]; }
+
+	void			read(quint64 *values) const;
+
+	// "1.2M", "340K", or "12.3ms" for times
+	static void		format(char *buf, size_t size, const char *name, quint64 value);
+
+private:
+	bool			openCounter(const char *name, unsigned int type, unsigned long long config);
+
+	int			mFds[MaxCounters];
+	const char *		mNames[MaxCounters];
+	int			mCount;
+	bool			mRusage;
+};
+
+#endif /* PUPPETEER_PERFCOUNTERS_H */
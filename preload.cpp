@@ -0,0 +1,73 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Inject Puppeteer into applications that know nothing about it
+//
+//	LD_PRELOAD=libpuppeteer-preload.so PUPPETEER_PLAYBACK=script.xml app
+//
+//	We interpose QApplication::exec(), which is the first point
+//	at which we can be sure that the QApplication exists, and
+//	start Puppeteer there before handing over to the real exec().
+//	Recording needs to be asked for with PUPPETEER_RECORD=1 here,
+//	as we cannot tell whether the user wanted to record anything
+//	otherwise. Without any of the PUPPETEER_* variables, we do
+//	nothing at all.
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qapplication.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include "puppeteer.h"
+
+typedef int		(*ExecFunc)();
+
+static bool
+wantPuppeteer()
+{
+	static const char *vars[] = {
+		"PUPPETEER_PLAYBACK",
+		"PUPPETEER_SESSION",
+		"PUPPETEER_TEST",
+		"PUPPETEER_CONTROLLER",
+		"PUPPETEER_EXPORT",
+		"PUPPETEER_FLIGHT_RECORDER",
+		"PUPPETEER_REPLAY",
+		"PUPPETEER_WATCHDOG",
+		"PUPPETEER_EVENT_PROFILE",
+		"PUPPETEER_TRACE",
+		"PUPPETEER_MEMORY",
+		"PUPPETEER_RECORD",
+		NULL
+	};
+
+	for (const char **v = vars; *v; ++v) {
+		if (getenv(*v) != NULL)
+			return true;
+	}
+	return false;
+}
+
+int
+QApplication::exec()
+{
+	static ExecFunc realExec;
+
+	if (realExec == 0) {
+		realExec = (ExecFunc) dlsym(RTLD_NEXT, "_ZN12QApplication4execEv");
+		if (realExec == 0) {
+			fprintf(stderr, "puppeteer-preload: cannot find QApplication::exec: %s\n", dlerror());
+			abort();
+		}
+	}
+
+	// Applications built with Puppeteer may have started it already.
+	// Nested event loops call exec() again, too.
+	if (Puppeteer::instance() == 0 && wantPuppeteer()) {
+		printf("=== Puppeteer injected into %s\n", qPrintable(qApp->applicationName()));
+		Puppeteer::start();
+	}
+
+	return realExec();
+}
@@ -18,20 +18,86 @@
 #include <qcombobox.h>
 #include <qabstractitemview.h>
 #include <qmetaobject.h>
+#include <qtextdocument.h>
+#include <qpixmap.h>
+#include <qimage.h>
 
 #include <qdom.h>
 #include <qfile.h>
+#include <qfileinfo.h>
+#include <qdir.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
 #include "puppeteer.h"
 #include "namespace.h"
+#include "snapshot.h"
+#include "imagecompare.h"
+#include "goldenstore.h"
+#include "pathtable.h"
+#include "eventexport.h"
+#include "flightrecorder.h"
+#include "scriptrecorder.h"
+#include "latency.h"
+#include "watchdog.h"
+#include "eventprofile.h"
+#include "eventstats.h"
+#include "perfcounters.h"
+#include "sampler.h"
+#include "trace.h"
+#include "census.h"
 
 
 static bool		neverRecordEvent(QEvent::Type type);
 
+Puppeteer *		Puppeteer::sInstance;
+
 Puppeteer::Puppeteer()
-: applicationActive(false), mScript(0)
+: applicationActive(false), mQuitting(false), mPlayback(false), mScript(0),
+  mFailurePolicy(FailureExit), mExitStatus(-1), mRecentEventsMax(32),
+  mRecentEventsSeen(0),
+  mSyncInject(false), mSyncDispatching(false), mSyncPending(false), mSyncMark(0),
+  mSnapshots(0), mSnapshotSteps(false), mLatency(0), mStep(1),
+  mSession(false), mSessionIndex(-1), mSessionRound(0), mSessionSettle(500),
+  mReplay(false), mReplaySpeed(1), mReplayStarted(0), mReplayReached(0),
+  mReplayEvents(0), mReplayFailed(0), mReplaySyncMatched(0), mReplaySyncDropped(0),
+  mReplayReported(false),
+  mControllerListen(-1), mControllerFd(-1), mControllerOut(0),
+  mControllerAcceptNotifier(0), mControllerReadNotifier(0), mControllerWriteNotifier(0),
+  mControllerSeq(0), mControllerQueued(0),
+  mPaths(0), mExporter(0), mFlight(0), mWatchdog(0),
+  mProfile(0), mProfileTop(20), mPerf(0), mSampler(0),
+  mTrace(0), mTraceSlices(false), mTraceThreshold(50), mTraceScriptStart(-1),
+  mTraceStepStart(0), mTracePerformStart(0), mTraceTimeout(-1),
+  mCensus(0), mMemoryMaxRss(0), mMemoryMaxObjects(0), mTesting(false),
+  mScriptRecorder(0), mStats(0)
 {
+	const char *value;
+
+	if ((value = getenv("PUPPETEER_ON_FAILURE")) != NULL) {
+		if (!strcmp(value, "continue"))
+			mFailurePolicy = FailureContinue;
+		else
+		if (!strcmp(value, "abort"))
+			mFailurePolicy = FailureAbort;
+		else
+		if (strcmp(value, "exit"))
+			fprintf(stderr, "=== Ignoring unknown failure policy \"%s\"\n", value);
+	}
+
+	if ((value = getenv("PUPPETEER_SYNC")) != NULL && strcmp(value, "0")) {
+		mSyncInject = true;
+
+		// Events caused by a synchronous action are looked up here
+		mRecentEventsMax = 256;
+	}
+
+	if ((value = getenv("PUPPETEER_RECENT_EVENTS")) != NULL)
+		mRecentEventsMax = atoi(value);
+
 	connect(qApp, SIGNAL(aboutToQuit()), SLOT(aboutToQuitSlot()));
 }
 
@@ -39,6 +105,34 @@ Puppeteer::~Puppeteer()
 {
 	if (mScript)
 		delete mScript;
+	if (mSnapshots)
+		delete mSnapshots;
+	if (mLatency)
+		delete mLatency;
+	while (!mRecentEvents.isEmpty())
+		delete mRecentEvents.takeFirst();
+	if (mExporter)
+		delete mExporter;
+	if (mFlight)
+		delete mFlight;
+	if (mWatchdog)
+		delete mWatchdog;
+	if (mProfile)
+		delete mProfile;
+	if (mPerf)
+		delete mPerf;
+	if (mSampler)
+		delete mSampler;
+	if (mTrace)
+		delete mTrace;
+	if (mCensus)
+		delete mCensus;
+	if (mScriptRecorder)
+		delete mScriptRecorder;
+	if (mStats)
+		delete mStats;
+	if (mPaths)
+		delete mPaths;
 }
 
 void
@@ -47,22 +141,176 @@ Puppeteer::start()
 	Puppeteer *self = new Puppeteer;
 	const char *script;
 
-	script = getenv("PUPPETEER_PLAYBACK");
-	if (script != NULL)
+	sInstance = self;
+
+	if ((script = getenv("PUPPETEER_EXPORT")) != NULL)
+		self->exportStart(script);
+	if ((script = getenv("PUPPETEER_FLIGHT_RECORDER")) != NULL)
+		self->flightStart(script);
+	if ((script = getenv("PUPPETEER_WATCHDOG")) != NULL)
+		self->watchdogStart(script);
+	if ((script = getenv("PUPPETEER_EVENT_PROFILE")) != NULL)
+		self->profileStart(script);
+	if ((script = getenv("PUPPETEER_TRACE")) != NULL)
+		self->traceStart(script);
+	if ((script = getenv("PUPPETEER_MEMORY")) != NULL)
+		self->memoryStart(script);
+
+	if ((script = getenv("PUPPETEER_CONTROLLER")) != NULL)
+		self->controllerStart(script);
+	else
+	if ((script = getenv("PUPPETEER_SESSION")) != NULL)
+		self->sessionStart(expandScriptList(script));
+	else
+	if ((script = getenv("PUPPETEER_TEST")) != NULL)
+		self->testStart(script);
+	else
+	if ((script = getenv("PUPPETEER_REPLAY")) != NULL)
+		self->replayStart(script);
+	else
+	if ((script = getenv("PUPPETEER_PLAYBACK")) != NULL)
 		self->playbackStart(script);
 	else
 		self->startRecording();
 }
 
+Puppeteer *
+Puppeteer::instance()
+{
+	return sInstance;
+}
+
+const char *
+Puppeteer::exitStatusName(int status)
+{
+	switch (status) {
+	case ExitPass:
+		return "PASS";
+	case ExitFail:
+		return "FAIL";
+	case ExitTimeout:
+		return "TIMEOUT";
+	case ExitScriptError:
+		return "SCRIPT-ERROR";
+	}
+	return "UNKNOWN";
+}
+
 void
 Puppeteer::startRecording()
 {
+	const char *value;
+
+	// Write a script that can be played back, rather than all events
+	if ((value = getenv("PUPPETEER_RECORD")) != NULL && !strcmp(value, "script"))
+		mScriptRecorder = new ScriptRecorder;
+
+	// Or just count them
+	if (value != NULL && !strcmp(value, "stats")) {
+		int interval = 60;
+
+		if (mPaths == 0)
+			mPaths = new PathTable;
+		mStats = new EventStats(mPaths);
+
+		if ((value = getenv("PUPPETEER_STATS_INTERVAL")) != NULL)
+			interval = atoi(value);
+		if (interval > 0) {
+			connect(&mStatsTimer, SIGNAL(timeout()), this, SLOT(statsDumpSlot()));
+			mStatsTimer.start(1000 * interval);
+		}
+	}
+
+	qApp->installEventFilter(this);
+}
+
+/*
+ * Stream events to another process through shared memory. This works in
+ * addition to recording or playback.
+ */
+void
+Puppeteer::exportStart(const char *path)
+{
+	unsigned long capacity = 4096;
+	EventExporter::Policy policy = EventExporter::PolicyDrop;
+	const char *value;
+
+	if ((value = getenv("PUPPETEER_EXPORT_SIZE")) != NULL && atoi(value) >= 64)
+		capacity = atoi(value);
+
+	if ((value = getenv("PUPPETEER_EXPORT_POLICY")) != NULL) {
+		if (!strcmp(value, "overwrite"))
+			policy = EventExporter::PolicyOverwrite;
+		else
+		if (!strcmp(value, "block"))
+			policy = EventExporter::PolicyBlock;
+		else
+		if (strcmp(value, "drop"))
+			fprintf(stderr, "=== Unknown PUPPETEER_EXPORT_POLICY \"%s\", dropping events when the ring is full\n", value);
+	}
+
+	if (mPaths == 0)
+		mPaths = new PathTable;
+
+	mExporter = new EventExporter(mPaths);
+	if (!mExporter->open(QFile::decodeName(path), capacity * 1024, policy)) {
+		delete mExporter;
+		mExporter = 0;
+		return;
+	}
+
+	// Recording and playback install it too; that's harmless
+	qApp->installEventFilter(this);
+}
+
+/*
+ * Keep recent events in memory, and write them out when things go wrong.
+ * Unless we're playing back a script, this replaces recording.
+ */
+void
+Puppeteer::flightStart(const char *filename)
+{
+	unsigned int maxEvents = 10000;
+	quint64 maxAge = 0;
+	const char *value;
+
+	if ((value = getenv("PUPPETEER_FLIGHT_EVENTS")) != NULL && atoi(value) > 0)
+		maxEvents = atoi(value);
+	if ((value = getenv("PUPPETEER_FLIGHT_SECONDS")) != NULL)
+		maxAge = (quint64) atoi(value) * 1000000;
+
+	if (mPaths == 0)
+		mPaths = new PathTable;
+
+	mFlight = new FlightRecorder(mPaths, QFile::decodeName(filename), maxEvents, maxAge);
+	mFlight->installSignalHandlers();
+
+	printf("=== Flight recorder keeps the last %u events; dumps go to %s\n", maxEvents, filename);
+
 	qApp->installEventFilter(this);
 }
 
+/*
+ * Find the path id of an object, building its path if we haven't seen it yet
+ */
+quint32
+Puppeteer::internObjectPath(QObject *object)
+{
+	quint32 id;
+
+	if ((id = mPaths->lookup(object)) == 0) {
+		EventRecord scratch("intern");
+
+		id = mPaths->insert(object, buildObjectPath(object, &scratch));
+	}
+	return id;
+}
+
 void
 Puppeteer::aboutToQuitSlot()
 {
+	mQuitting = true;
+
 	if (mScript) {
 		// Playback case
 		Script::Action *playbackAction;
@@ -73,13 +321,93 @@ Puppeteer::aboutToQuitSlot()
 			playbackNextAction();
 		}
 
-		if (mScript->currentAction() == 0)
+		if (mReplay) {
+			// Quitting is part of the recording, whether or not it's over
+			replayReport();
+			mExitStatus = mReplayFailed? ExitFail : ExitPass;
+		} else
+		if (mScript->currentAction() == 0) {
 			printf("=== All is well. Script succeeded\n");
-		else
+			mExitStatus = ExitPass;
+		} else {
 			printf("=== Ooops, application exits before script is done\n");
-	} else {
+			playbackDiagnostics();
+			mExitStatus = ExitFail;
+		}
+	}
+
+	if (mLatency)
+		mLatency->report();
+
+	if (mWatchdog) {
+		// Tearing down the application is none of our business
+		mWatchdog->stop();
+		mWatchdogTimer.stop();
+		mWatchdog->report();
+	}
+
+	if (mProfile)
+		profileReport();
+
+	if (mPerf)
+		perfReport();
+
+	if (mCensus) {
+		mMemoryTimer.stop();
+		mCensus->report(20);
+	}
+
+	if (mSampler) {
+		if (mSampler->write(mSamplerDir))
+			printf("=== Profile of %lu samples written to %s (%lu dropped)\n",
+					mSampler->samples(), qPrintable(mSamplerDir), mSampler->dropped());
+		delete mSampler;
+		mSampler = 0;
+	}
+
+	if (mExporter)
+		mExporter->close();
+
+	if (mControllerOut) {
+		fprintf(mControllerOut, "<application-exit status=\"%d\"/>\n", mExitStatus);
+		fflush(mControllerOut);
+
+		// There is no event loop to wait for the controller in any more
+		controllerDrain(1000);
+	}
+
+	if (mSession) {
+		// The current script, and whatever did not get to run, count as failed
+		if (mSessionIndex < mSessionScripts.count()) {
+			while ((mSessionIndex = mSessionResults.count()) < mSessionScripts.count())
+				sessionScriptDone(ExitFail);
+			sessionSummary();
+		}
+	} else
+	if (!mPlayback) {
 		// Recording case
-		RecordNode("quit").write();
+		if (mScriptRecorder)
+			mScriptRecorder->finish();
+		else
+		if (mStats)
+			statsDumpSlot();
+		else
+			RecordNode("quit").write();
+	}
+
+	if (mTrace) {
+		if (mPlayback && !mSession)
+			traceScriptDone(mExitStatus);
+		traceStop();
+	}
+
+	// Make the exit status of the process reflect the outcome of the script,
+	// no matter what the application's main() does after exec() returns.
+	if (mPlayback && mExitStatus >= 0 && mFailurePolicy != FailureContinue) {
+		printf("=== Exiting with status %d\n", mExitStatus);
+		fflush(stdout);
+		fflush(stderr);
+		_exit(mExitStatus);
 	}
 }
 
@@ -91,22 +419,77 @@ Puppeteer::actionTimeoutSlot()
 	if (mScript == 0 || (currentAction = mScript->currentAction()) == 0)
 		return;
 
+	if (!playbackIsSync(currentAction) || mSyncDispatching) {
+		playbackPerformAction(currentAction);
+		return;
+	}
+
+	/* Run synchronous actions back to back. Whatever happens while
+	 * one of them is being performed - including a wait-event
+	 * matching, or the next action becoming current - only sets
+	 * mSyncPending, and we pick up the next action here.
+	 */
+	mSyncDispatching = true;
+	mSyncMark = mRecentEventsSeen;
+	do {
+		mSyncPending = false;
+		playbackPerformAction(currentAction);
+	} while (mSyncPending && mScript && (currentAction = mScript->currentAction()) != 0);
+	mSyncDispatching = false;
+}
+
+void
+Puppeteer::playbackPerformAction(Script::Action *currentAction)
+{
+	if (mTrace)
+		mTracePerformStart = timestampUsec();
+
 	switch (currentAction->type()) {
 	case Script::WaitApplicationExit:
 		printf("=== Timed out waiting for application to exit (after %lu msec)\n", currentAction->timeout());
-		playbackFailure();
+		playbackFailure(ExitTimeout);
 		break;
 
 	case Script::WaitEvent:
-		printf("=== Timed out waiting for event (after %lu msec)\n", currentAction->timeout());
+		if (mReplay) {
+			replayMissed(currentAction);
+			playbackNextAction();
+			break;
+		}
 
-		/* We should probably terminate the application here, somehow */
-		playbackFailure();
+		printf("=== Timed out waiting for event (after %lu msec)\n", currentAction->timeout());
+		playbackFailure(ExitTimeout);
 		break;
 
 	case Script::SendEvent:
-		// Get ready to inject the event
-		playbackEvent(currentAction->event());
+		if (mReplay) {
+			if (replayEvent(currentAction))
+				playbackNextAction();
+			break;
+		}
+
+		// Get ready to inject the event; this reports failure itself
+		if (!playbackEvent(currentAction->event()))
+			break;
+
+		playbackNextAction();
+		break;
+
+	case Script::Click:
+		if (!playbackClick(currentAction->event())) {
+			playbackFailure();
+			break;
+		}
+
+		playbackNextAction();
+		break;
+
+	case Script::TypeText:
+		if (!playbackTypeText(currentAction->event())) {
+			playbackFailure();
+			break;
+		}
+
 		playbackNextAction();
 		break;
 
@@ -128,224 +511,1338 @@ Puppeteer::actionTimeoutSlot()
 		playbackNextAction();
 		break;
 
+	case Script::VerifySnapshot:
+		if (!playbackVerifySnapshot(currentAction->event())) {
+			playbackFailure();
+			break;
+		}
+
+		playbackNextAction();
+		break;
+
+	case Script::VerifyImage:
+		if (!playbackVerifyImage(currentAction->event())) {
+			playbackFailure();
+			break;
+		}
+
+		playbackNextAction();
+		break;
+
+	case Script::TakeSnapshot:
+		if (!playbackTakeSnapshot(currentAction->event())) {
+			playbackFailure();
+			break;
+		}
+
+		playbackNextAction();
+		break;
+
+	case Script::Condition:
+		mScript->setCondition(playbackCondition(currentAction->event()));
+		playbackNextAction();
+		break;
+
 	default:
 		printf("=== Timed out waiting for something that's not implemented\n");
+		playbackFailure(ExitScriptError);
+		break;
+	}
+}
+
+void
+Puppeteer::scriptTimeoutSlot()
+{
+	if (mTesting) {
+		printf("=== Test did not complete within the time allowed by PUPPETEER_TIMEOUT\n");
+		testFailed(ExitTimeout);
+		return;
+	}
+
+	// Done already, and waiting for the application to quit
+	if (mScript == 0 || mScript->currentAction() == 0)
+		return;
+
+	printf("=== Script did not complete within the time allowed by PUPPETEER_TIMEOUT\n");
+	playbackFailure(ExitTimeout);
+}
+
+void
+Puppeteer::statsDumpSlot()
+{
+	if (mStats)
+		mStats->dump(stdout, 20);
+}
+
+/*
+ * Stall watchdog; see watchdog.h
+ */
+void
+Puppeteer::watchdogStart(const char *msec)
+{
+	Watchdog *watchdog = new Watchdog(atoi(msec) > 0? atoi(msec) : 500);
+
+	if (!watchdog->start()) {
+		fprintf(stderr, "=== Unable to start the stall watchdog\n");
+		delete watchdog;
+		return;
+	}
+	mWatchdog = watchdog;
+
+	// Keep the watchdog happy while there are no events
+	connect(&mWatchdogTimer, SIGNAL(timeout()), this, SLOT(watchdogHeartbeatSlot()));
+	mWatchdogTimer.start(mWatchdog->threshold() / 2);
+
+	printf("=== Watchdog reports stalls of more than %u msec\n", mWatchdog->threshold());
+}
+
+void
+Puppeteer::watchdogHeartbeatSlot()
+{
+	if (mWatchdog)
+		mWatchdog->progress();
+}
+
+/*
+ * Things needed for playback regardless of the number of scripts
+ */
+void
+Puppeteer::playbackSetup()
+{
+	const char *value;
+
+	mPlayback = true;
+
+	connect(&mTimer, SIGNAL(timeout()), this, SLOT(actionTimeoutSlot()));
+
+	mScriptTimer.setSingleShot(true);
+	connect(&mScriptTimer, SIGNAL(timeout()), this, SLOT(scriptTimeoutSlot()));
+
+	mSnapshots = new SnapshotTracker;
+	mSnapshotSteps = (getenv("PUPPETEER_SNAPSHOT_STEPS") != NULL);
+
+	if (getenv("PUPPETEER_LATENCY") != NULL)
+		mLatency = new LatencyTracker;
+
+	if (getenv("PUPPETEER_PERF") != NULL)
+		perfStart();
+
+	if ((value = getenv("PUPPETEER_PROFILE")) != NULL) {
+		unsigned int hz = 1000;
+
+		mSamplerDir = value;
+		if ((value = getenv("PUPPETEER_PROFILE_HZ")) != NULL && atoi(value) > 0)
+			hz = atoi(value);
+
+		mSampler = new Sampler;
+		if (mSampler->start(hz, 64)) {
+			printf("=== Sampling the GUI thread %u times per CPU second\n", hz);
+		} else {
+			fprintf(stderr, "=== Unable to start the sampling profiler\n");
+			delete mSampler;
+			mSampler = 0;
+		}
+	}
+
+	qApp->installEventFilter(this);
+}
+
+/*
+ * Playback
+ */
+void
+Puppeteer::playbackStart(QString filename)
+{
+	const char *value;
+	Script *script;
+
+	playbackSetup();
+
+	script = new Script;
+	if (!script->load(filename)) {
+		fprintf(stderr, "Unable to parse playback script \"%s\"\n", qPrintable(filename));
+		delete script;
+
+		// The event loop is not running yet, so there's nothing to tear down
+		mExitStatus = ExitScriptError;
+		if (mFailurePolicy != FailureContinue) {
+			fflush(stdout);
+			_exit(mExitStatus);
+		}
+		return;
+	}
+	playbackSyncSetup(script);
+
+	gettimeofday(&mScriptStarted, NULL);
+	if ((value = getenv("PUPPETEER_TIMEOUT")) != NULL)
+		mScriptTimer.start(1000 * atoi(value));
+
+	if (mTrace)
+		traceScriptStart(filename);
+
+	// Now execute it
+	mScript = script;
+	if (script->currentAction() == 0) {
+		// Uhm, empty script
+		playbackFinished();
+	} else {
+		playbackDescribeAction(script->currentAction());
+	}
+}
+
+void
+Puppeteer::playbackDescribeAction(const Script::Action *action)
+{
+	if (action == 0)
+		return;
+
+	switch (action->type()) {
+	case Script::WaitApplicationExit:
+		printf("=== Waiting for application to exit\n");
+		break;
+
+	case Script::WaitEvent:
+		printf("=== Waiting for event:\n");
+		action->event()->write();
+		break;
+
+	case Script::SendEvent:
+		printf("=== Preparing to send event\n");
+		action->event()->write();
 		break;
+
+	case Script::SetFocus:
+		printf("=== Preparing to set keyboard focus\n");
+		break;
+
+	case Script::VerifyProperties:
+		printf("=== Preparing to verify UI state\n");
+		break;
+
+	case Script::VerifySnapshot:
+		printf("=== Preparing to verify UI snapshot\n");
+		break;
+
+	case Script::VerifyImage:
+		printf("=== Preparing to verify widget image\n");
+		break;
+
+	case Script::TakeSnapshot:
+		printf("=== Preparing to take a snapshot\n");
+		break;
+
+	case Script::Click:
+		printf("=== Preparing to click\n");
+		action->event()->write();
+		break;
+
+	case Script::TypeText:
+		printf("=== Preparing to type text\n");
+		action->event()->write();
+		break;
+
+	case Script::Condition:
+		printf("=== Preparing to check a condition\n");
+		action->event()->write();
+		break;
+
+	default:
+		printf("=== I'm sure I'm about to do something meaningful, but I can't say what it is\n");
+	}
+}
+
+bool
+Puppeteer::playbackNextAction()
+{
+	Script::Action *nextAction;
+
+	mTimer.stop();
+
+	if (!mScript)
+		return false;
+
+	if (mSnapshotSteps)
+		playbackSnapshotStep();
+
+	if (mControllerOut)
+		controllerResult(mControllerSeq++, exitStatusName(ExitPass));
+
+	playbackStepDone(mScript->currentAction(), ExitPass);
+
+	mScript->actionDone();
+	mStep++;
+
+	if ((nextAction = mScript->currentAction()) == 0) {
+		playbackFinished();
+	} else {
+		playbackDescribeAction(nextAction);
+		playbackArmTimer(nextAction);
+	}
+
+	return true;
+}
+
+/*
+ * Close the books on the current step, before moving on to the next
+ */
+void
+Puppeteer::playbackStepDone(const Script::Action *action, ExitStatus status)
+{
+	QString label;
+
+	if (mPerf)
+		perfStep(action, exitStatusName(status));
+
+	if (mTrace)
+		traceStep(action, status);
+
+	if (mSampler) {
+		if (mSession && mSessionIndex < mSessionScripts.count())
+			label = QFileInfo(mSessionScripts[mSessionIndex]).baseName() + "-";
+		label += action? action->name() : "none";
+		if (status != ExitPass)
+			label += QString("-") + exitStatusName(status);
+		mSampler->stepDone(label);
+	}
+}
+
+void
+Puppeteer::playbackArmTimer(const Script::Action *action)
+{
+	unsigned long timeout = action->timeout();
+
+	if (mSyncDispatching) {
+		if (playbackIsSync(action) && (!mReplay || replayDelay(action) == 0)) {
+			mSyncPending = true;
+			return;
+		}
+		if (playbackSyncLookback(action))
+			return;
+	}
+
+	// No settle delay; but let the event loop catch up after a wait
+	if (mReplay)
+		timeout = replayDelay(action);
+	else
+	if (playbackIsSync(action))
+		timeout = 0;
+
+	mTraceTimeout = timeout;
+
+	mTimer.setInterval(timeout);
+	mTimer.setSingleShot(true);
+	mTimer.start();
+}
+
+/*
+ * Synchronous actions deliver their events with QApplication::sendEvent(),
+ * so their effects are there as soon as the action is done, and there's
+ * no need to wait before the next one. This applies to all actions that
+ * are performed rather than waited for.
+ */
+bool
+Puppeteer::playbackIsSync(const Script::Action *action) const
+{
+	QString sync;
+
+	switch (action->type()) {
+	case Script::WaitApplicationExit:
+	case Script::WaitEvent:
+		return false;
+	default: ;
+	}
+
+	if (action->event())
+		sync = action->event()->attribute("sync");
+	if (sync == "true")
+		return true;
+	if (sync == "false")
+		return false;
+	return mSyncInject;
+}
+
+/*
+ * Events caused by a synchronous action are looked up among the recent
+ * ones, so keep more of them for a script that has any, as PUPPETEER_SYNC
+ * does, unless PUPPETEER_RECENT_EVENTS says how many.
+ */
+void
+Puppeteer::playbackSyncSetup(const Script *script)
+{
+	if (mRecentEventsMax < 256 && getenv("PUPPETEER_RECENT_EVENTS") == NULL
+	 && script->hasSyncActions())
+		mRecentEventsMax = 256;
+}
+
+/*
+ * A wait-event that follows a synchronous action may be waiting for
+ * something that already happened while the action was performed. Look
+ * for it among the events seen since we started running synchronous
+ * actions.
+ */
+bool
+Puppeteer::playbackSyncLookback(const Script::Action *action)
+{
+	quint64 first;
+	int i;
+
+	if (action->type() != Script::WaitEvent)
+		return false;
+
+	first = mRecentEventsSeen - mRecentEvents.count();
+	i = (mSyncMark > first)? mSyncMark - first : 0;
+	for (; i < mRecentEvents.count(); ++i) {
+		const EventRecord *rec = mRecentEvents[i];
+
+		if (!action->matchCurrentEvent(rec))
+			continue;
+
+		printf("=== Matched Event (during synchronous action):\n");
+		rec->write();
+		printf("===\n");
+
+		// Each event satisfies a single wait
+		mSyncMark = first + i + 1;
+
+		if (mControllerOut)
+			controllerMatched(rec);
+		if (mReplay)
+			mReplaySyncMatched++;
+
+		playbackNextAction();
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Deliver an event we built, and tell whether the receiver survived it
+ */
+bool
+Puppeteer::playbackDeliver(QWidget *widget, QEvent *ev, bool sync)
+{
+	QPointer<QWidget> guard(widget);
+
+	if (mLatency)
+		mLatency->injected(widget, ev, mStep);
+	if (mTrace)
+		traceInjected(widget, ev);
+
+	if (!sync) {
+		qApp->postEvent(widget, ev);
+		return true;
+	}
+
+	QApplication::sendEvent(widget, ev);
+	delete ev;
+	return !guard.isNull();
+}
+
+bool
+Puppeteer::playbackEvent(const EventRecord *rec)
+{
+	QWidget *widget;
+	QEvent *ev;
+	bool sync;
+
+	if (!(widget = objectForRecord(rec))) {
+		fprintf(stderr, "=== cannot inject event, receiver object not found\n");
+		rec->write();
+		playbackFailure();
+		return false;
+	}
+
+	if (!(ev = buildEvent(widget, rec))) {
+		fprintf(stderr, "=== cannot inject event, unable to build event from spec\n");
+		rec->write();
+		playbackFailure();
+		return false;
+	}
+
+	sync = playbackIsSync(mScript->currentAction());
+
+	printf(sync? "=== Sending event:\n" : "=== Posting event:\n");
+	rec = recordEvent(widget, ev);
+	rec->write();
+	delete rec;
+
+	playbackDeliver(widget, ev, sync);
+
+	return true;
+}
+
+/*
+ * Press and release a mouse button, as if the user clicked
+ */
+bool
+Puppeteer::playbackClick(const EventRecord *rec)
+{
+	QWidget *widget;
+	QMouseEvent *press, *release;
+	bool sync = playbackIsSync(mScript->currentAction());
+
+	if (!(widget = objectForRecord(rec))) {
+		fprintf(stderr, "=== cannot click, receiver object not found\n");
+		rec->write();
+		return false;
+	}
+
+	if (!(press = buildMouseEvent(widget, QEvent::MouseButtonPress, rec))) {
+		fprintf(stderr, "=== cannot click, unable to build event from spec\n");
+		rec->write();
+		return false;
+	}
+
+	release = new QMouseEvent(QEvent::MouseButtonRelease, press->pos(),
+				press->button(), press->buttons() & ~press->button(),
+				press->modifiers());
+
+	printf("=== Clicking at <%d,%d>\n", press->x(), press->y());
+	if (!playbackDeliver(widget, press, sync)) {
+		// Whatever it was, the press made it go away
+		printf("=== Receiver was deleted on mouse press, not releasing\n");
+		delete release;
+		return true;
+	}
+	playbackDeliver(widget, release, sync);
+
+	return true;
+}
+
+/*
+ * Type a string into a widget. All events are posted in one go, so that
+ * the whole string costs a single settle delay rather than one per key.
+ * Synchronous typing sends them one after the other instead.
+ *
+ * By default, every character becomes a key press and release; whatever
+ * can't be typed on a US keyboard goes through the input method instead.
+ * With method="inputmethod", the whole string is committed through the
+ * input method at once, which is a lot faster for long texts.
+ */
+bool
+Puppeteer::playbackCommitText(QWidget *widget, QString &text, bool sync)
+{
+	QInputMethodEvent *ev;
+
+	if (text.isEmpty())
+		return true;
+
+	ev = new QInputMethodEvent;
+	ev->setCommitString(text);
+	text = QString();
+	return playbackDeliver(widget, ev, sync);
+}
+
+bool
+Puppeteer::playbackTypeText(const EventRecord *rec)
+{
+	QWidget *widget;
+
+	if (!(widget = objectForRecord(rec))) {
+		fprintf(stderr, "=== cannot type text, receiver object not found\n");
+		rec->write();
+		return false;
+	}
+
+	if (!playbackTypeText(widget, rec->attribute("text"), rec->attribute("method") == "inputmethod",
+				playbackIsSync(mScript->currentAction()))) {
+		rec->write();
+		return false;
+	}
+	return true;
+}
+
+bool
+Puppeteer::playbackTypeText(QWidget *widget, QString text, bool inputMethod, bool sync)
+{
+	QString pending;
+	unsigned int count = 0;
+	bool alive;
+
+	if (inputMethod) {
+		printf("=== Committing %d characters through the input method\n", text.length());
+		playbackCommitText(widget, text, sync);
+		return true;
+	}
+
+	alive = true;
+	for (int i = 0; alive && i < text.length(); ++i) {
+		Qt::KeyboardModifiers modifiers;
+		QString keyText;
+		int key;
+
+		if (!keyForCharacter(text[i], &key, &modifiers)) {
+			pending += text[i];
+			continue;
+		}
+		if (!playbackCommitText(widget, pending, sync))
+			break;
+
+		keyText = (key == Qt::Key_Return)? QString("\r") : QString(text[i]);
+		alive = playbackDeliver(widget, new QKeyEvent(QEvent::KeyPress, key, modifiers, keyText), sync)
+		     && playbackDeliver(widget, new QKeyEvent(QEvent::KeyRelease, key, modifiers, keyText), sync);
+		count++;
+	}
+	if (alive)
+		alive = playbackCommitText(widget, pending, sync);
+
+	if (!alive) {
+		fprintf(stderr, "=== cannot type text, receiver was deleted after %u key events\n", count);
+		return false;
+	}
+
+	printf("=== Typed %d characters, %u of them as key events\n", text.length(), count);
+	return true;
+}
+
+bool
+Puppeteer::playbackSetFocus(const EventRecord *rec)
+{
+	QWidget *w;
+
+	if (!(w = objectForRecord(rec))) {
+		fprintf(stderr, "=== cannot set focus, receiver object not found\n");
+		rec->write();
+		return false;
+	}
+
+	if (qApp->focusWidget() == w) {
+		fprintf(stderr, "=== object already has focus\n");
+		return true;
+	}
+
+	// Note: this is somewhat tricky. During the execution of the setFocus() call,
+	// we will enter a recursive event loop, during which the FocusIn event
+	// arrives. If we wanted to match for this event, we would have to post this
+	// event match here. However, we don't have anything like "auxiliary" event
+	// matching in place, so we just ignore this and explicitly check for the
+	// application focus widget.
+	w->setFocus(Qt::OtherFocusReason);
+
+	if (qApp->focusWidget() != w) {
+		fprintf(stderr, "=== unable to set focus\n");
+		return false;
+	}
+
+	return true;
+}
+
+bool
+Puppeteer::playbackVerifyProperties(const EventRecord *rec)
+{
+	RecordNode *data;
+	QWidget *w;
+
+	if (!(w = objectForRecord(rec))) {
+		fprintf(stderr, "=== cannot verify properties, receiver object not found\n");
+		rec->write();
+		return false;
+	}
+
+	if ((data = rec->child("classdata")) == 0) {
+		printf("=== No classdata provided.\n");
+		return false;
+	}
+
+	const RecordNode::list &list(data->children());
+	for (RecordNode::list::const_iterator it = list.begin(); it != list.end(); ++it) {
+		const RecordNode *child = *it;
+		QString propertyName, expectedValue, actualValue;
+
+		if (child->name() != "property")
+			continue;
+
+		propertyName = child->attribute("name");
+		expectedValue = child->attribute("value");
+		if (!getObjectProperty(w, propertyName, actualValue)) {
+			printf("=== Object does not support property %s\n", qPrintable(propertyName));
+			return false;
+		}
+
+		if (expectedValue != actualValue) {
+			printf("=== Object property %s does not match. Expected \"%s\", got \"%s\"\n",
+					qPrintable(propertyName),
+					qPrintable(expectedValue),
+					qPrintable(actualValue));
+			return false;
+		}
+
+		printf("=== Verify ok: object property %s=\"%s\"\n",
+				qPrintable(propertyName),
+				qPrintable(expectedValue));
+	}
+
+	printf("=== PASS: Successfully verified properties\n");
+	return true;
+}
+
+/*
+ * For <while> and <if>: an object, optionally with a property
+ * that has a given value. Unlike verification, not holding is fine.
+ */
+bool
+Puppeteer::playbackCondition(const EventRecord *rec)
+{
+	QString propertyName = rec->attribute("property"), value;
+	bool holds;
+	QWidget *w;
+
+	if (!(w = objectForRecord(rec))) {
+		printf("=== Condition does not hold: object not found\n");
+		return false;
+	}
+
+	if (propertyName.isEmpty()) {
+		printf("=== Condition holds: object found\n");
+		return true;
+	}
+
+	if (!getObjectProperty(w, propertyName, value)) {
+		printf("=== Object does not support property %s\n", qPrintable(propertyName));
+		return false;
+	}
+
+	holds = mScript->compare(value, rec);
+	printf("=== Condition %s: object property %s=\"%s\"\n",
+			holds? "holds" : "does not hold", qPrintable(propertyName), qPrintable(value));
+	return holds;
+}
+
+bool
+Puppeteer::playbackVerifySnapshot(const EventRecord *rec)
+{
+	QString filename = rec->attribute("golden");
+	Snapshot actual, golden;
+	QStringList changes;
+	QWidget *w = 0;
+
+	if (filename.isEmpty()) {
+		printf("=== No golden snapshot file given.\n");
+		return false;
+	}
+
+	// Without an objectPath, we snapshot all top-level windows
+	if (!rec->attribute("objectPath").isEmpty()
+	 && !(w = objectForRecord(rec))) {
+		fprintf(stderr, "=== cannot verify snapshot, receiver object not found\n");
+		rec->write();
+		return false;
+	}
+
+	actual = mSnapshots->capture(w);
+
+	if (!golden.load(filename)) {
+		if (getenv("PUPPETEER_UPDATE_GOLDEN") == NULL) {
+			printf("=== Unable to load golden snapshot \"%s\"\n", qPrintable(filename));
+			return false;
+		}
+
+		if (!actual.save(filename)) {
+			printf("=== Unable to write golden snapshot \"%s\"\n", qPrintable(filename));
+			return false;
+		}
+
+		printf("=== Stored new golden snapshot \"%s\"\n", qPrintable(filename));
+		return true;
+	}
+
+	if (golden.diff(actual, changes, rec->attribute("geometry") != "false")) {
+		printf("=== Snapshot does not match golden \"%s\":\n", qPrintable(filename));
+		for (QStringList::const_iterator it = changes.begin(); it != changes.end(); ++it)
+			printf("    %s\n", qPrintable(*it));
+		return false;
+	}
+
+	printf("=== PASS: Snapshot matches golden \"%s\"\n", qPrintable(filename));
+	return true;
+}
+
+/*
+ * Capture the UI state after each step, and show what changed
+ * compared to the previous step.
+ */
+void
+Puppeteer::playbackSnapshotStep()
+{
+	Snapshot current = mSnapshots->capture();
+	Snapshot &previous(mSnapshots->lastStep());
+	QStringList changes;
+
+	if (!previous.isNull() && previous.diff(current, changes)) {
+		printf("=== UI changes in this step:\n");
+		for (QStringList::const_iterator it = changes.begin(); it != changes.end(); ++it)
+			printf("    %s\n", qPrintable(*it));
+	}
+
+	previous = current;
+}
+
+/*
+ * Capture the widget tree and hand it to whoever is interested:
+ * the controller if there is one, a file if given, stdout otherwise.
+ */
+bool
+Puppeteer::playbackTakeSnapshot(const EventRecord *rec)
+{
+	QString filename = rec->attribute("file");
+	Snapshot snapshot;
+	QWidget *w = 0;
+
+	if (!rec->attribute("objectPath").isEmpty()
+	 && !(w = objectForRecord(rec))) {
+		fprintf(stderr, "=== cannot take snapshot, receiver object not found\n");
+		rec->write();
+		return false;
+	}
+
+	snapshot = mSnapshots->capture(w);
+
+	if (!filename.isEmpty()) {
+		if (!snapshot.save(filename)) {
+			printf("=== Unable to write snapshot \"%s\"\n", qPrintable(filename));
+			return false;
+		}
+	} else
+	if (mControllerOut) {
+		snapshot.write(mControllerOut);
+		fflush(mControllerOut);
+	} else {
+		snapshot.write(stdout);
+	}
+
+	return true;
+}
+
+bool
+Puppeteer::playbackVerifyImage(const EventRecord *rec)
+{
+	QString filename = rec->attribute("golden");
+	QString ref = rec->attribute("ref");
+	unsigned int tolerance = rec->attribute("tolerance").toUInt();
+	unsigned long maxDiffPixels = rec->attribute("maxDiffPixels").toULong();
+	struct timeval t0, t1, delta;
+	QImage actual, expected;
+	QList<QRect> masks;
+	QString basename;
+	unsigned long ndiff;
+	QWidget *w;
+
+	if (filename.isEmpty() && ref.isEmpty()) {
+		printf("=== No golden image given.\n");
+		return false;
+	}
+
+	if (!(w = objectForRecord(rec))) {
+		fprintf(stderr, "=== cannot verify image, receiver object not found\n");
+		rec->write();
+		return false;
+	}
+
+	const RecordNode::list &children(rec->children());
+	for (RecordNode::list::const_iterator it = children.begin(); it != children.end(); ++it) {
+		const RecordNode *child = *it;
+
+		if (child->name() != "mask")
+			continue;
+
+		masks.append(QRect(child->attribute("x").toInt(),
+				child->attribute("y").toInt(),
+				child->attribute("width").toInt(),
+				child->attribute("height").toInt()));
+	}
+
+	actual = QPixmap::grabWidget(w).toImage().convertToFormat(QImage::Format_ARGB32);
+
+	if (!ref.isEmpty()) {
+		GoldenStore store;
+		QString actualId = GoldenStore::imageId(actual), goldenId;
+
+		if (!store.lookup(ref, goldenId)) {
+			if (getenv("PUPPETEER_UPDATE_GOLDEN") == NULL) {
+				printf("=== No golden image \"%s\" in store %s\n", qPrintable(ref), qPrintable(store.directory()));
+				return false;
+			}
+
+			if (!store.add(ref, actual, actualId)) {
+				printf("=== Unable to add golden image \"%s\" to store %s\n", qPrintable(ref), qPrintable(store.directory()));
+				return false;
+			}
+
+			printf("=== Stored new golden image \"%s\" as %s\n", qPrintable(ref), qPrintable(actualId));
+			return true;
+		}
+
+		// A bit-identical capture needs neither decoding nor comparing the golden
+		if (goldenId == actualId) {
+			printf("=== PASS: Image matches golden \"%s\" (%s)\n", qPrintable(ref), qPrintable(goldenId));
+			return true;
+		}
+
+		filename = store.objectFile(goldenId);
+		if ((expected = store.load(goldenId)).isNull()) {
+			printf("=== Golden image %s is missing from the store\n", qPrintable(filename));
+			return false;
+		}
+
+		basename = store.directory() + "/failed/" + ref;
+		QDir().mkpath(QFileInfo(basename).path());
+	} else {
+		if (!expected.load(filename)) {
+			if (getenv("PUPPETEER_UPDATE_GOLDEN") == NULL) {
+				printf("=== Unable to load golden image \"%s\"\n", qPrintable(filename));
+				return false;
+			}
+
+			if (!actual.save(filename, "PNG")) {
+				printf("=== Unable to write golden image \"%s\"\n", qPrintable(filename));
+				return false;
+			}
+
+			printf("=== Stored new golden image \"%s\"\n", qPrintable(filename));
+			return true;
+		}
+		expected = expected.convertToFormat(QImage::Format_ARGB32);
+
+		basename = filename;
+		if (basename.endsWith(".png"))
+			basename.chop(4);
+	}
+
+	if (actual.size() != expected.size()) {
+		printf("=== Image size does not match golden \"%s\". Expected %dx%d, got %dx%d\n",
+				qPrintable(filename),
+				expected.width(), expected.height(),
+				actual.width(), actual.height());
+		actual.save(basename + ".actual.png", "PNG");
+		return false;
+	}
+
+	gettimeofday(&t0, NULL);
+	ndiff = compareImages(actual, expected, tolerance, masks);
+	gettimeofday(&t1, NULL);
+	timersub(&t1, &t0, &delta);
+
+	printf("=== Compared %dx%d image in %lu.%03lu msec (%s kernel), %lu pixels differ\n",
+			actual.width(), actual.height(),
+			(unsigned long) (delta.tv_sec * 1000 + delta.tv_usec / 1000),
+			(unsigned long) (delta.tv_usec % 1000),
+			imageCompareKernel(), ndiff);
+
+	if (ndiff > maxDiffPixels) {
+		printf("=== Image does not match golden \"%s\"; see %s.diff.png\n",
+				qPrintable(filename), qPrintable(basename));
+		buildDiffImage(actual, expected, tolerance, masks).save(basename + ".diff.png", "PNG");
+		actual.save(basename + ".actual.png", "PNG");
+		return false;
+	}
+
+	printf("=== PASS: Image matches golden \"%s\"\n", qPrintable(filename));
+	return true;
+}
+
+void
+Puppeteer::playbackFailure(ExitStatus status)
+{
+	printf("=== Playback failed, tape completely garbled.\n");
+	mTimer.stop();
+
+	if (mScript)
+		playbackStepDone(mScript->currentAction(), status);
+
+	playbackDiagnostics();
+
+	if (mFlight && mFlight->dump())
+		printf("=== Flight recorder written to %s\n", mFlight->filename());
+
+	// The controller decides what to do next
+	if (mControllerOut && mFailurePolicy != FailureAbort) {
+		controllerFailure(status);
+		return;
+	}
+
+	if (mScript)
+		delete mScript;
+	mScript = 0;
+
+	// In a session, we just move on to the next script
+	if (mSession && mFailurePolicy != FailureAbort) {
+		sessionScriptDone(status);
+		return;
+	}
+
+	playbackTerminate(status);
+}
+
+/*
+ * Tell whoever reads the log as much as we can about the state
+ * we were in when things went wrong.
+ */
+void
+Puppeteer::playbackDiagnostics()
+{
+	Script::Action *action;
+
+	if (mScript && (action = mScript->currentAction()) != 0) {
+		printf("=== Failed action:\n");
+		playbackDescribeAction(action);
+		if (action->event())
+			action->event()->write();
+	}
+
+	if (!mRecentEvents.isEmpty()) {
+		printf("=== Most recent events:\n");
+		for (QList<EventRecord *>::const_iterator it = mRecentEvents.begin(); it != mRecentEvents.end(); ++it)
+			(*it)->write();
+	}
+
+	if (mSnapshots) {
+		printf("=== Widget tree:\n");
+		mSnapshots->capture().write(stdout);
+	}
+
+	printf("=== End of diagnostics\n");
+	fflush(stdout);
+}
+
+static volatile sig_atomic_t	exitStatusOnAlarm;
+
+static void
+exitAlarmHandler(int sig)
+{
+	_exit(exitStatusOnAlarm);
+}
+
+void
+Puppeteer::playbackTerminate(ExitStatus status)
+{
+	const char *value;
+	int grace = 2;
+
+	mExitStatus = status;
+
+	switch (mFailurePolicy) {
+	case FailureContinue:
+		printf("=== Leaving the application running, as requested\n");
+		return;
+
+	case FailureAbort:
+		fflush(stdout);
+		fflush(stderr);
+		abort();
+
+	default: ;
+	}
+
+	printf("=== Terminating application with exit status %d\n", status);
+	fflush(stdout);
+
+	// Ask the application to quit nicely; aboutToQuitSlot will pick up the exit status.
+	// Should it fail to do so within the grace period (for instance, because the GUI
+	// thread is blocked), cut it short.
+	if ((value = getenv("PUPPETEER_EXIT_GRACE")) != NULL)
+		grace = atoi(value);
+
+	exitStatusOnAlarm = status;
+	signal(SIGALRM, exitAlarmHandler);
+	alarm(grace > 0? grace : 1);
+
+	qApp->exit(status);
+}
+
+void
+Puppeteer::playbackFinished()
+{
+	if (mScript && mScript->failed()) {
+		playbackFailure(ExitScriptError);
+		return;
+	}
+
+	printf("=== Playback reached end of tape. Watch the spinning reels and listen to the white noise.\n");
+	mTimer.stop();
+
+	if (mSession)
+		sessionScriptDone(ExitPass);
+	else
+	if (mReplay) {
+		// A recording usually ends with the application quitting; if not, do it now
+		replayReport();
+		playbackTerminate(mReplayFailed? ExitFail : ExitPass);
+	} else
+	if (mControllerListen < 0 && !mQuitting) {
+		// The script didn't wait for the application to exit on its own
+		mScriptTimer.stop();
+		playbackTerminate(ExitPass);
 	}
 }
 
 /*
- * Playback
+ * Sessions run several scripts back to back in the same application
+ * process, so that we pay for application startup only once.
+ * PUPPETEER_SESSION is a colon separated list of scripts, or of
+ * directories containing scripts. C++ tests run the same way.
  */
 void
-Puppeteer::playbackStart(QString filename)
+Puppeteer::sessionStart(const QStringList &list)
 {
-	Script *script;
+	const char *value;
 
-	script = new Script;
-	if (!script->load(filename)) {
-		fprintf(stderr, "Unable to parse playback script \"%s\"\n", qPrintable(filename));
-		return;
-	}
+	mSession = true;
+	mSessionScripts = list;
+	mSessionRound = list.count();
 
-	connect(&mTimer, SIGNAL(timeout()), this, SLOT(actionTimeoutSlot()));
+	if ((value = getenv("PUPPETEER_SESSION_SETTLE")) != NULL)
+		mSessionSettle = atoi(value);
 
-	// Now execute it
-	mScript = script;
-	if (script->currentAction() == 0) {
-		// Uhm, empty script
-		playbackFinished();
-	} else {
-		playbackDescribeAction(script->currentAction());
+	// Soak tests go through the same scripts over and over
+	if ((value = getenv("PUPPETEER_SESSION_REPEAT")) != NULL) {
+		QStringList once = mSessionScripts;
+
+		for (int i = 1; i < atoi(value); ++i)
+			mSessionScripts += once;
 	}
 
-	qApp->installEventFilter(this);
+	printf("=== Session with %d %s\n", mSessionScripts.count(), mTesting? "tests" : "scripts");
+
+	playbackSetup();
+
+	// The event loop is not running yet; we start the first script
+	// as soon as it does.
+	QTimer::singleShot(0, this, SLOT(sessionNextSlot()));
 }
 
-void
-Puppeteer::playbackDescribeAction(const Script::Action *action)
+/*
+ * Expand a colon separated list of scripts and directories
+ */
+QStringList
+Puppeteer::expandScriptList(const QString &list)
 {
-	if (action == 0)
-		return;
+	QStringList paths = list.split(':', QString::SkipEmptyParts);
+	QStringList result;
 
-	switch (action->type()) {
-	case Script::WaitApplicationExit:
-		printf("=== Waiting for application to exit\n");
-		break;
+	for (QStringList::const_iterator it = paths.begin(); it != paths.end(); ++it) {
+		QFileInfo info(*it);
 
-	case Script::WaitEvent:
-		printf("=== Waiting for event:\n");
-		action->event()->write();
-		break;
+		if (info.isDir()) {
+			QDir dir(*it);
+			QStringList names = dir.entryList(QStringList("*.xml"), QDir::Files, QDir::Name);
 
-	case Script::SendEvent:
-		printf("=== Preparing to send event\n");
-		action->event()->write();
-		break;
+			for (QStringList::const_iterator nt = names.begin(); nt != names.end(); ++nt)
+				result.append(dir.filePath(*nt));
+		} else {
+			result.append(*it);
+		}
+	}
 
-	case Script::SetFocus:
-		printf("=== Preparing to set keyboard focus\n");
-		break;
+	return result;
+}
 
-	case Script::VerifyProperties:
-		printf("=== Preparing to verify UI state\n");
-		break;
+/*
+ * Remember which windows were there when the application came up, so that
+ * we can close everything else between scripts.
+ */
+void
+Puppeteer::sessionRememberWindows()
+{
+	QWidgetList toplevels = qApp->topLevelWidgets();
 
-	default:
-		printf("=== I'm sure I'm about to do something meaningful, but I can't say what it is\n");
+	mSessionWindows.clear();
+	for (QWidgetList::const_iterator it = toplevels.begin(); it != toplevels.end(); ++it) {
+		if ((*it)->isVisible())
+			mSessionWindows.append(*it);
 	}
+
+	mSessionFocus = qApp->focusWidget();
 }
 
-bool
-Puppeteer::playbackNextAction()
+void
+Puppeteer::sessionReset(const QString &nextScript)
 {
-	Script::Action *nextAction;
+	const char *hook;
+	QWidget *w;
+	int count;
 
-	mTimer.stop();
+	printf("=== Session: resetting application state for %s\n", qPrintable(nextScript));
 
-	if (!mScript)
-		return false;
-	mScript->actionDone();
+	// Popups first, as they grab mouse and keyboard
+	for (count = 0; (w = qApp->activePopupWidget()) != 0 && count < 16; ++count)
+		w->close();
 
-	if ((nextAction = mScript->currentAction()) == 0) {
-		playbackFinished();
-	} else {
-		playbackDescribeAction(nextAction);
-		mTimer.setInterval(nextAction->timeout());
-		mTimer.setSingleShot(true);
-		mTimer.start();
+	QWidgetList toplevels = qApp->topLevelWidgets();
+	for (QWidgetList::const_iterator it = toplevels.begin(); it != toplevels.end(); ++it) {
+		w = *it;
+
+		if (!w->isVisible() || mSessionWindows.contains(w))
+			continue;
+
+		printf("=== Session: closing window %s (%s)\n",
+				qPrintable(w->objectName()), w->metaObject()->className());
+		w->close();
 	}
 
-	return true;
+	if (!mSessionFocus.isNull()) {
+		mSessionFocus->window()->activateWindow();
+		mSessionFocus->setFocus(Qt::OtherFocusReason);
+	}
+
+	emit sessionReset();
+
+	// PUPPETEER_RESET_HOOK=objectPath:slot lets us reset applications
+	// that do not know about us
+	if ((hook = getenv("PUPPETEER_RESET_HOOK")) != NULL) {
+		QString spec(hook);
+		int colon = spec.lastIndexOf(':');
+		EventRecord rec("ResetHook");
+		QObject *receiver;
+
+		rec.addAttribute("objectPath", spec.left(colon));
+		if (colon < 0 || (receiver = objectForRecord(&rec)) == 0) {
+			fprintf(stderr, "=== Session: cannot find receiver for reset hook %s\n", hook);
+		} else
+		if (!QMetaObject::invokeMethod(receiver, qPrintable(spec.mid(colon + 1)), Qt::DirectConnection)) {
+			fprintf(stderr, "=== Session: unable to invoke reset hook %s\n", hook);
+		}
+	}
 }
 
-bool
-Puppeteer::playbackEvent(const EventRecord *rec)
+void
+Puppeteer::sessionScriptDone(ExitStatus status)
 {
-	QWidget *widget;
-	QEvent *ev;
+	struct timeval now, delta;
+	SessionResult result;
 
-	if (!(widget = objectForRecord(rec))) {
-		fprintf(stderr, "=== cannot inject event, receiver object not found\n");
-		rec->write();
-		playbackFailure();
-		return false;
-	}
+	// Already accounted for
+	if (mSessionIndex < 0 || mSessionResults.count() > mSessionIndex)
+		return;
 
-	if (!(ev = buildEvent(widget, rec))) {
-		fprintf(stderr, "=== cannot inject event, unable to build event from spec\n");
-		rec->write();
-		playbackFailure();
-		return false;
-	}
+	gettimeofday(&now, NULL);
+	timersub(&now, &mScriptStarted, &delta);
 
-	printf("=== Posting event:\n");
-	rec = recordEvent(widget, ev);
-	rec->write();
-	delete rec;
+	result.script = mSessionScripts[mSessionIndex];
+	result.status = status;
+	result.msec = delta.tv_sec * 1000 + delta.tv_usec / 1000;
+	mSessionResults.append(result);
 
-	qApp->postEvent(widget, ev);
+	printf("=== RESULT %s %lu msec %s\n", exitStatusName(status), result.msec, qPrintable(result.script));
 
-	return true;
+	if (mTrace)
+		traceScriptDone(status);
+
+	mTimer.stop();
+	mScriptTimer.stop();
+
+	// Don't pull the script out from under our callers
+	QTimer::singleShot(0, this, SLOT(sessionNextSlot()));
 }
 
-bool
-Puppeteer::playbackSetFocus(const EventRecord *rec)
+void
+Puppeteer::sessionNextSlot()
 {
-	QWidget *w;
-
-	if (!(w = objectForRecord(rec))) {
-		fprintf(stderr, "=== cannot set focus, receiver object not found\n");
-		rec->write();
-		return false;
+	if (mScript) {
+		delete mScript;
+		mScript = 0;
 	}
 
-	if (qApp->focusWidget() == w) {
-		fprintf(stderr, "=== object already has focus\n");
-		return true;
+	// This can happen if the last script was done before the application quit
+	if (mSessionResults.count() <= mSessionIndex)
+		return;
+
+	if (++mSessionIndex >= mSessionScripts.count()) {
+		sessionSummary();
+		playbackTerminate((ExitStatus) mExitStatus);
+		return;
 	}
 
-	// Note: this is somewhat tricky. During the execution of the setFocus() call,
-	// we will enter a recursive event loop, during which the FocusIn event
-	// arrives. If we wanted to match for this event, we would have to post this
-	// event match here. However, we don't have anything like "auxiliary" event
-	// matching in place, so we just ignore this and explicitly check for the
-	// application focus widget.
-	w->setFocus(Qt::OtherFocusReason);
+	if (mSampler && mSessionIndex > 0 && mSessionIndex % mSessionRound == 0)
+		mSampler->rewind();
 
-	if (qApp->focusWidget() != w) {
-		fprintf(stderr, "=== unable to set focus\n");
-		return false;
+	if (mSessionIndex == 0) {
+		sessionRunSlot();
+	} else {
+		sessionReset(mSessionScripts[mSessionIndex]);
+		QTimer::singleShot(mSessionSettle, this, SLOT(sessionRunSlot()));
 	}
-
-	return true;
 }
 
-bool
-Puppeteer::playbackVerifyProperties(const EventRecord *rec)
+void
+Puppeteer::sessionRunSlot()
 {
-	RecordNode *data;
-	QWidget *w;
+	QString filename = mSessionScripts[mSessionIndex];
+	Script::Action *action;
+	const char *value;
+	Script *script;
 
-	if (!(w = objectForRecord(rec))) {
-		fprintf(stderr, "=== cannot verify properties, receiver object not found\n");
-		rec->write();
-		return false;
-	}
+	printf("=== Session: starting script %d of %d, %s\n",
+			mSessionIndex + 1, mSessionScripts.count(), qPrintable(filename));
 
-	if ((data = rec->child("classdata")) == 0) {
-		printf("=== No classdata provided.\n");
-		return false;
+	// One sample per iteration, with the application reset to where it started
+	if (mCensus && !memorySample(QString("script %1").arg(mSessionIndex + 1), true)) {
+		playbackTerminate(ExitFail);
+		return;
 	}
 
-	const RecordNode::list &list(data->children());
-	for (RecordNode::list::const_iterator it = list.begin(); it != list.end(); ++it) {
-		const RecordNode *child = *it;
-		QString propertyName, expectedValue, actualValue;
+	while (!mRecentEvents.isEmpty())
+		delete mRecentEvents.takeFirst();
+	mSnapshots->lastStep() = Snapshot();
 
-		if (child->name() != "property")
-			continue;
+	gettimeofday(&mScriptStarted, NULL);
+	if ((value = getenv("PUPPETEER_TIMEOUT")) != NULL)
+		mScriptTimer.start(1000 * atoi(value));
 
-		propertyName = child->attribute("name");
-		expectedValue = child->attribute("value");
-		if (!getObjectProperty(w, propertyName, actualValue)) {
-			printf("=== Object does not support property %s\n", qPrintable(propertyName));
-			return false;
-		}
+	if (mTesting) {
+		testRun(filename);
+		return;
+	}
 
-		if (expectedValue != actualValue) {
-			printf("=== Object property %s does not match. Expected \"%s\", got \"%s\"\n",
-					qPrintable(propertyName),
-					qPrintable(expectedValue),
-					qPrintable(actualValue));
-			return false;
-		}
+	script = new Script;
+	if (!script->load(filename)) {
+		fprintf(stderr, "Unable to parse playback script \"%s\"\n", qPrintable(filename));
+		delete script;
+		sessionScriptDone(ExitScriptError);
+		return;
+	}
+	playbackSyncSetup(script);
+	mScript = script;
+	mStep = 1;
+	if (mPerf)
+		perfReset();
+	if (mTrace)
+		traceScriptStart(filename);
+
+	// The application came up long ago, don't wait for it to do it again
+	while ((action = script->currentAction()) != 0
+	    && action->type() == Script::WaitEvent
+	    && action->event()->attribute("type") == "ApplicationActivate"
+	    && applicationActive) {
+		script->actionDone();
+		mStep++;
+	}
 
-		printf("=== Verify ok: object property %s=\"%s\"\n",
-				qPrintable(propertyName),
-				qPrintable(expectedValue));
+	if (action == 0) {
+		playbackFinished();
+		return;
 	}
 
-	printf("=== PASS: Successfully verified properties\n");
-	return true;
+	playbackDescribeAction(action);
+
+	// Waiting for the application to start up may take a while
+	if (applicationActive || action->type() != Script::WaitEvent)
+		playbackArmTimer(action);
 }
 
 void
-Puppeteer::playbackFailure()
+Puppeteer::sessionSummary()
 {
-	printf("=== Playback failed, tape completely garbled.\n");
-	mTimer.stop();
+	int worst = ExitPass;
 
-	if (mScript)
-		delete mScript;
-	mScript = 0;
-}
+	printf("=== Session summary:\n");
+	for (QList<SessionResult>::const_iterator it = mSessionResults.begin(); it != mSessionResults.end(); ++it) {
+		printf("    %-12s %8lu msec  %s\n", exitStatusName(it->status), it->msec, qPrintable(it->script));
+		if (it->status > worst)
+			worst = it->status;
+	}
 
-void
-Puppeteer::playbackFinished()
-{
-	printf("=== Playback reached end of tape. Watch the spinning reels and listen to the white noise.\n");
-	mTimer.stop();
+	mExitStatus = worst;
 }
 
 /*
@@ -360,13 +1857,61 @@ Puppeteer::playbackFinished()
  * being waited for.
  *
  * Note that injection of events does not happen here; we always delay these by
- * a little bit - hence, injection happens from actionTimeoutSlot().
+ * a little bit - hence, injection happens from actionTimeoutSlot(). Synchronous
+ * injection calls back into here for the events it sends; see playbackArmTimer()
+ * for how that is kept from advancing the script underneath it.
  */
 bool
 Puppeteer::eventFilter(QObject *object, QEvent *event)
 {
 	EventRecord *rec;
 
+	if (mWatchdog) {
+		RecordNode *stall;
+
+		mWatchdog->progress();
+		if ((stall = mWatchdog->takeStall()) != 0) {
+			// Keep it out of a script that is being recorded
+			stall->write(mScriptRecorder? stderr : stdout);
+			if (mTrace)
+				traceStall(stall);
+			delete stall;
+		}
+	}
+
+	if (mSnapshots)
+		mSnapshots->observeEvent(object, event);
+	if (mCensus)
+		mCensus->observeEvent(object, event);
+	if (mLatency)
+		mLatency->observeEvent(object, event);
+
+	if (mTrace && !mTraceSlices && !neverRecordEvent(event->type()))
+		traceEventSeen(object, event);
+
+	// Before looking up a path that would have changed
+	if (mPaths && (event->type() == QEvent::ChildAdded || event->type() == QEvent::ChildRemoved))
+		mPaths->forget(((QChildEvent *) event)->child());
+
+	if ((mExporter || mFlight) && !neverRecordEvent(event->type())) {
+		quint32 pathId = internObjectPath(object);
+
+		if (mExporter)
+			mExporter->exportEvent(pathId, event);
+		if (mFlight)
+			mFlight->recordEvent(pathId, event);
+	}
+
+	// The flight recorder is all the recording we do
+	if (mFlight && !mPlayback)
+		return false;
+
+	// Same for statistics, which don't need an EventRecord either
+	if (mStats) {
+		mStats->count(event->type(), internObjectPath(object), object->metaObject());
+		return false;
+	}
+
 	/* TBD: If the script is just idling, don't even bother with
 	 * analyzing this event
 	 */
@@ -382,16 +1927,39 @@ Puppeteer::eventFilter(QObject *object, QEvent *event)
 					rec->write();
 					printf("===\n");
 
+					if (mControllerOut)
+						controllerMatched(rec);
+					if (mReplay)
+						mReplaySyncMatched++;
+
 					playbackNextAction();
 				}
 			}
-		} else {
+
+			if (mRecentEventsMax > 0) {
+				mRecentEvents.append(rec);
+				mRecentEventsSeen++;
+				if (mRecentEvents.count() > mRecentEventsMax)
+					delete mRecentEvents.takeFirst();
+				rec = 0;
+			}
+		} else
+		if (!mPlayback) {
 			// Recording case
-			rec->write();
+			if (mScriptRecorder) {
+				mScriptRecorder->recordEvent(object, event, rec);
+				rec = 0;
+			} else {
+				rec->write();
+			}
 		}
 		delete rec;
 	}
 
+	// After recordEvent(), which tells us when the application is up
+	if (mTesting)
+		testObserveEvent(object, event);
+
 	return false;
 }
 
@@ -665,6 +2233,8 @@ Puppeteer::recordEvent(QObject *object, QEvent *event)
 	switch (event->type()) {
 	case QEvent::ApplicationActivate:
 		// No event playback prior to this stage
+		if (!applicationActive && mSession)
+			sessionRememberWindows();
 		applicationActive = true;
 		break;
 	case QEvent::MouseButtonPress:
@@ -803,23 +2373,47 @@ Puppeteer::sanitizeButtonString(QString text) const
 	return text;
 }
 
-QString
-Puppeteer::timestamp()
+/*
+ * Microseconds since the first call
+ */
+quint64
+Puppeteer::timestampUsec()
 {
 	static struct timeval t0;
 	struct timeval now, delta;
-	QString timestamp;
 
 	if (t0.tv_sec == 0)
 		gettimeofday(&t0, NULL);
 	gettimeofday(&now, NULL);
 	timersub(&now, &t0, &delta);
-	timestamp.sprintf("%u.%06u", (unsigned int) delta.tv_sec, (unsigned int) delta.tv_usec);
 
+	return (quint64) delta.tv_sec * 1000000 + delta.tv_usec;
+}
+
+QString
+Puppeteer::timestamp()
+{
+	quint64 usec = timestampUsec();
+	QString timestamp;
+
+	timestamp.sprintf("%u.%06u", (unsigned int) (usec / 1000000), (unsigned int) (usec % 1000000));
 	return timestamp;
 }
 
 
+/*
+ * Scripts say "modifiers", recordings say "keyboardModifiers"
+ */
+static Qt::KeyboardModifiers
+recordModifiers(const EventRecord *rec)
+{
+	QString value = rec->attribute("modifiers");
+
+	if (value.isEmpty())
+		value = rec->attribute("keyboardModifiers");
+	return keyboardModifiersFromString(value);
+}
+
 QEvent *
 Puppeteer::buildEvent(QWidget *&widget, const EventRecord *rec) const
 {
@@ -879,8 +2473,7 @@ Puppeteer::buildMouseEvent(QWidget *&widget, QEvent::Type type, const EventRecor
 		havePos = true;
 	}
 
-	value = rec->attribute("modifiers");
-	// TBD: map the string to Qt::KeyboardModifiers
+	modifiers = recordModifiers(rec);
 
 	if (!havePos) {
 		const RecordNode *classHints = rec->classHints();
@@ -1065,22 +2658,27 @@ Puppeteer::buildKeyEvent(QWidget *&object, QEvent::Type type, const EventRecord
 {
 	QKeyEvent *ev;
 	Qt::KeyboardModifiers modifiers = 0;
-	Qt::Key key = (Qt::Key) 0;
-	QString value;
+	int key = 0;
+	QString value, text;
+
+	text = rec->attribute("text");
 
 	value = rec->attribute("key");
 	if (!value.isEmpty())
 		key = keyFromString(value);
+	else
+	if (text.length() == 1)
+		keyForCharacter(text[0], &key, &modifiers);
 
 	if (key == 0) {
 		fprintf(stderr, "=== No or invalid key in key event\n");
 		return 0;
 	}
 
-	value = rec->attribute("modifiers");
-	// TBD: map the string to Qt::KeyboardModifiers
+	if (!rec->attribute("modifiers").isEmpty() || !rec->attribute("keyboardModifiers").isEmpty())
+		modifiers = recordModifiers(rec);
 
-	ev = new QKeyEvent(type, key, modifiers);
+	ev = new QKeyEvent(type, key, modifiers, text);
 	return ev;
 }
 
@@ -1190,6 +2788,17 @@ RecordNode::addAttribute(const QString &name, const QString &value)
 	mAttributes.append(Attribute(name, value));
 }
 
+void
+RecordNode::removeAttribute(const QString &name)
+{
+	for (Attribute::list::iterator it(mAttributes.begin()); it != mAttributes.end(); ) {
+		if (it->name == name)
+			it = mAttributes.erase(it);
+		else
+			++it;
+	}
+}
+
 QString
 RecordNode::attribute(const QString &name) const
 {
@@ -1205,25 +2814,31 @@ RecordNode::attribute(const QString &name) const
 bool
 RecordNode::write(int indent) const
 {
-	printf("%*.*s", indent, indent, "");
-	printf("<%s", qPrintable(mName));
+	return write(stdout, indent);
+}
+
+bool
+RecordNode::write(FILE *fp, int indent) const
+{
+	fprintf(fp, "%*.*s", indent, indent, "");
+	fprintf(fp, "<%s", qPrintable(mName));
 
 	for (QList<Attribute>::const_iterator it(mAttributes.begin()); it != mAttributes.end(); ++it) {
 		const Attribute &a(*it);
-		printf(" %s=\"%s\"", qPrintable(a.name), qPrintable(a.value));
+		fprintf(fp, " %s=\"%s\"", qPrintable(a.name), qPrintable(Qt::escape(a.value).replace('"', "&quot;")));
 	}
 
 	if (mChildren.count() == 0) {
-		printf("/>\n");
+		fprintf(fp, "/>\n");
 	} else {
-		printf(">\n");
+		fprintf(fp, ">\n");
 
 		for (QList<RecordNode *>::const_iterator it = mChildren.begin(); it != mChildren.end(); ++it) {
-			(*it)->write(indent + 2);
+			(*it)->write(fp, indent + 2);
 		}
 
-		printf("%*.*s", indent, indent, "");
-		printf("</%s>\n", qPrintable(mName));
+		fprintf(fp, "%*.*s", indent, indent, "");
+		fprintf(fp, "</%s>\n", qPrintable(mName));
 	}
 
 	return true;
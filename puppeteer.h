@@ -5,12 +5,35 @@
 #include <qobject.h>
 #include <qevent.h>
 #include <qmap.h>
+#include <qhash.h>
 #include <qtimer.h>
+#include <qpointer.h>
+#include <qvector.h>
+#include <qpair.h>
+#include <qstringlist.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <stdio.h>
 
 class QMenuBar;
 class QMenu;
 class QDomElement;
+class QSocketNotifier;
+class PathTable;
+class EventExporter;
+class FlightRecorder;
+class ScriptRecorder;
 class QComboBox;
+class SnapshotTracker;
+class LatencyTracker;
+class Watchdog;
+class EventProfile;
+class EventStats;
+class PerfCounters;
+class Sampler;
+class TraceWriter;
+class ObjectCensus;
+class TestCase;
 
 class Attribute {
 public:
@@ -34,8 +57,10 @@ public:
 	~RecordNode();
 
 	const QString &		name() const { return mName; }
+	void			setName(const QString &name) { mName = name; }
 
 	void			addAttribute(const QString &name, const QString &value);
+	void			removeAttribute(const QString &name);
 	QString			attribute(const QString &name) const;
 	const Attribute::list &	attributes() const { return mAttributes; }
 
@@ -45,6 +70,7 @@ public:
 	RecordNode *		child(const QString &name) const;
 
 	bool			write(int indent = 0) const;
+	bool			write(FILE *fp, int indent = 0) const;
 
 protected:
 	bool			fromDomElement(const QDomElement &);
@@ -75,73 +101,291 @@ public:
 		WaitApplicationExit, WaitEvent, SendEvent,
 		SetFocus,
 		VerifyProperties,
+		VerifySnapshot,
+		VerifyImage,
+		TakeSnapshot,
+		Click,
+		TypeText,
+		Condition,
 	};
 	class Action {
 	private:
 		Action(Type type, EventRecord *record = 0)
-		: mType(type), mEventRecord(record), mTimeout(0) {}
+		: mType(type), mEventRecord(record), mTemplate(0), mTimeout(0), mAt(-1) {}
 
 	public:
 		~Action();
 
 		Type		type() const { return mType; }
+		const char *	name() const;
 		const EventRecord *event() const { return mEventRecord; }
 
 		unsigned long	timeout() const;
 		void		setTimeout(unsigned long timeout) { mTimeout = timeout; }
 
+		// Replay: when this happened in the recording, in usec, or -1
+		qint64		at() const { return mAt; }
+		void		setAt(qint64 usec) { mAt = usec; }
+
 		// WaitEvent processing
 		bool		matchCurrentEvent(const EventRecord *) const;
 
+		// Has sync="true", or may have, depending on a variable
+		bool		wantsSync() const;
+
+		// Actions that refer to ${variables} keep the record as written,
+		// and get a fresh copy with the current values when their turn comes
+		void		makeTemplate();
+		void		bind(const Script *);
+
 		static Action *	waitApplicationExit();
 		static Action *	waitEvent(EventRecord *);
 		static Action *	sendEvent(EventRecord *);
 		static Action *	setFocus(EventRecord *);
 		static Action *	verifyProperties(EventRecord *);
+		static Action *	verifySnapshot(EventRecord *);
+		static Action *	verifyImage(EventRecord *);
+		static Action *	takeSnapshot(EventRecord *);
+		static Action *	click(EventRecord *);
+		static Action *	typeText(EventRecord *);
+		static Action *	condition(EventRecord *);
 
 	private:
 		Type		mType;
 		EventRecord *	mEventRecord;
+		EventRecord *	mTemplate;
 		unsigned long	mTimeout;
+		qint64		mAt;
 	};
 
+	Script();
 	~Script();
 
 	bool			load(const QString &filename);
+	bool			loadRecording(const QString &filename);
+	bool			append(const QString &text);
 
-	Action *		currentAction() const;
+	// Actions left, not counting repetitions
+	int			count() const;
+	Action *		currentAction();
 	void			actionDone();
 
+	// The outcome of the Condition that is the current action
+	void			setCondition(bool holds) { mCondition = holds; }
+
+	// Whether the script went wrong, rather than coming to its end
+	bool			failed() const { return mFailed; }
+
+	bool			hasSyncActions() const;
+
+	QString			substitute(const QString &) const;
+	bool			compare(const QString &actual, const RecordNode *condition) const;
+
 private:
+	/*
+	 * Scripts are compiled to a list of instructions. Actions are
+	 * parsed once, and performed as often as the code comes by
+	 * them. a and b are an index into mActions or mOperands, and
+	 * a jump target, depending on the instruction.
+	 */
+	enum Opcode {
+		OpAction,	// perform action a
+		OpTest,		// perform Condition action a; if it doesn't hold, go to b
+		OpBranch,	// unless operand a holds, go to b
+		OpJump,		// go to a
+		OpSet,		// set the variable in operand a
+		OpRepeat,	// start a loop as given in operand a, which ends at b
+		OpNext,		// next round of the innermost loop, starting at a
+		OpCall,		// call the subroutine at a, with the variables in operand b
+		OpReturn,
+	};
+
+	struct Instruction {
+		Opcode		op;
+		int		a, b;
+	};
+
+	struct Loop {
+		int		remaining;
+		int		index;
+	};
+
+	static Action *		parseAction(const QDomElement &);
+	bool			appendElements(const QDomElement &);
+	bool			compileElements(const QDomElement &);
+	bool			compileElement(const QDomElement &);
+	bool			compileCondition(const QDomElement &);
+	int			addInstruction(Opcode op, int a = 0, int b = 0);
+	int			addOperand(const QDomElement &);
+	bool			run();
+	bool			evaluate(const RecordNode *) const;
+	void			error(const QString &);
+
 	QList<Action *>		mActions;
+	QList<EventRecord *>	mOperands;
+	QVector<Instruction>	mCode;
+	int			mPc;
+	bool			mReady;		// mPc is at an action, bound and ready to go
+	bool			mCondition;
+	bool			mFailed;
+
+	QHash<QString, QString>	mVariables;
+	QVector<Loop>		mLoops;
+	QVector<int>		mCalls;
+
+	// Subroutines by name, and the calls that need their address
+	QHash<QString, int>	mSubs;
+	QList<QPair<int, QString> > mFixups;
 };
 
 class Puppeteer : public QObject {
 	Q_OBJECT;
 
+	// C++ tests inject and look things up the way scripts do
+	friend class TestCase;
+
 public:
+	// Exit status of the application after playback.
+	// Keep these in sync with runner.cpp
+	enum ExitStatus {
+		ExitPass = 0,
+		ExitFail = 10,
+		ExitTimeout = 11,
+		ExitScriptError = 12,
+	};
+
+	// What to do when playback fails (PUPPETEER_ON_FAILURE)
+	enum FailurePolicy {
+		FailureExit,		// terminate the application with the exit status above
+		FailureContinue,	// leave the application running
+		FailureAbort,		// abort(), for a core dump
+	};
+
 	Puppeteer();
 	~Puppeteer();
 
 	static void		start();
+	static Puppeteer *	instance();
+
+	// Call before creating the QApplication; see zygote.cpp
+	static void		zygote();
+
+	static QStringList	expandScriptList(const QString &);
 
 	static QString		timestamp();
+	static quint64		timestampUsec();
+
+	static const char *	exitStatusName(int);
+
+	// Delivers the event; for the notify hook in eventprofile.cpp
+	bool			profileNotify(QObject *, QEvent *);
+
+signals:
+	// Emitted between two scripts of a session
+	void			sessionReset();
 
 protected slots:
 	void			aboutToQuitSlot();
 	void			actionTimeoutSlot();
+	void			scriptTimeoutSlot();
+	void			sessionNextSlot();
+	void			sessionRunSlot();
+	void			controllerAcceptSlot();
+	void			controllerReadSlot();
+	void			controllerWriteSlot();
+	void			watchdogHeartbeatSlot();
+	void			statsDumpSlot();
+	void			memoryTimerSlot();
+	void			testResumeSlot();
+	void			testTimeoutSlot();
+	void			testCheckSlot();
+	void			testSignalSlot();
+	void			testIdleSlot();
 
 protected:
 	void			startRecording();
-
+	void			exportStart(const char *path);
+	void			flightStart(const char *filename);
+	void			watchdogStart(const char *msec);
+	void			profileStart(const char *top);
+	void			profileReport();
+	bool			notifyHookStart();
+	void			notifyHookStop();
+
+	void			traceStart(const char *filename);
+	void			traceStop();
+	void			traceEventHandled(int track, QEvent::Type, const char *className, quint32 pathId, quint64 started);
+	void			traceEventSeen(QObject *, QEvent *);
+	void			traceInjected(QWidget *, QEvent *);
+	void			traceStall(const RecordNode *);
+	void			traceScriptStart(const QString &script);
+	void			traceScriptDone(int status);
+	void			traceStep(const Script::Action *, ExitStatus);
+
+	void			memoryStart(const char *interval);
+	bool			memorySample(const QString &label, bool walk);
+
+	void			testStart(const char *names);
+	void			testRun(const QString &name);
+	void			testObserveEvent(QObject *, QEvent *);
+	void			testResume();
+	void			testFailed(ExitStatus);
+	void			testDone(ExitStatus);
+
+	void			perfStart();
+	void			perfReset();
+	void			perfStep(const Script::Action *, const char *status);
+	void			perfReport();
+	quint32			internObjectPath(QObject *);
+
+	void			playbackSetup();
 	void			playbackStart(QString);
+	void			playbackArmTimer(const Script::Action *);
+	void			playbackPerformAction(Script::Action *);
+	bool			playbackIsSync(const Script::Action *) const;
+	bool			playbackSyncLookback(const Script::Action *);
+	void			playbackSyncSetup(const Script *);
 	void			playbackDescribeAction(const Script::Action *);
 	bool			playbackNextAction();
 	bool			playbackEvent(const EventRecord *rec);
 	bool			playbackSetFocus(const EventRecord *rec);
 	bool			playbackVerifyProperties(const EventRecord *rec);
-	void			playbackFailure();
+	bool			playbackCondition(const EventRecord *rec);
+	bool			playbackVerifySnapshot(const EventRecord *rec);
+	void			playbackSnapshotStep();
+	bool			playbackVerifyImage(const EventRecord *rec);
+	bool			playbackTakeSnapshot(const EventRecord *rec);
+	bool			playbackClick(const EventRecord *rec);
+	bool			playbackDeliver(QWidget *, QEvent *, bool sync);
+	bool			playbackCommitText(QWidget *, QString &text, bool sync);
+	bool			playbackTypeText(const EventRecord *rec);
+	bool			playbackTypeText(QWidget *, QString text, bool inputMethod, bool sync);
+	void			playbackFailure(ExitStatus status = ExitFail);
+	void			playbackDiagnostics();
+	void			playbackTerminate(ExitStatus status);
 	void			playbackFinished();
+	void			playbackStepDone(const Script::Action *, ExitStatus);
+
+	void			sessionStart(const QStringList &);
+	void			sessionRememberWindows();
+	void			sessionReset(const QString &nextScript);
+	void			sessionScriptDone(ExitStatus status);
+	void			sessionSummary();
+
+	bool			replayStart(const char *filename);
+	bool			replayEvent(const Script::Action *);
+	void			replayMissed(const Script::Action *);
+	unsigned long		replayDelay(const Script::Action *);
+	void			replayReport();
+
+	bool			controllerStart(const char *path);
+	void			controllerCommand(const QByteArray &);
+	void			controllerResult(unsigned int seq, const char *status);
+	void			controllerMatched(const EventRecord *);
+	void			controllerFailure(ExitStatus status);
+	void			controllerDisconnect();
+	void			controllerDrain(int msec);
+	static ssize_t		controllerCookieWrite(void *, const char *, size_t);
 
 	bool			eventFilter(QObject *, QEvent *);
 
@@ -176,8 +420,137 @@ private:
 
 private:
 	bool			applicationActive;
+	bool			mQuitting;
+	bool			mPlayback;
 	Script *		mScript;
 	QTimer			mTimer;
+
+	FailurePolicy		mFailurePolicy;
+	int			mExitStatus;
+
+	// The last few events seen during playback, for diagnostics
+	QList<EventRecord *>	mRecentEvents;
+	int			mRecentEventsMax;
+	quint64			mRecentEventsSeen;
+
+	// Synchronous injection (PUPPETEER_SYNC, or sync="true")
+	bool			mSyncInject;
+	bool			mSyncDispatching;
+	bool			mSyncPending;
+	quint64			mSyncMark;
+
+	SnapshotTracker *	mSnapshots;
+	bool			mSnapshotSteps;
+
+	// PUPPETEER_LATENCY; steps are numbered from 1 in each script
+	LatencyTracker *	mLatency;
+	unsigned int		mStep;
+
+	// Per script limit from PUPPETEER_TIMEOUT
+	QTimer			mScriptTimer;
+	struct timeval		mScriptStarted;
+
+	// Session mode: several scripts run back to back in one process
+	struct SessionResult {
+		QString		script;
+		int		status;
+		unsigned long	msec;
+	};
+
+	bool			mSession;
+	QStringList		mSessionScripts;
+	int			mSessionIndex;
+	int			mSessionRound;		// scripts per round of a soak test
+	QList<SessionResult>	mSessionResults;
+	QList<QPointer<QWidget> > mSessionWindows;
+	QPointer<QWidget>	mSessionFocus;
+	int			mSessionSettle;
+
+	// Timed replay of a recording, see replay.cpp
+	bool			mReplay;
+	double			mReplaySpeed;		// 0 means as fast as possible
+	quint64			mReplayStarted;
+	quint64			mReplayReached;		// time of the last event injected
+	unsigned int		mReplayEvents;
+	unsigned int		mReplayFailed;
+	unsigned int		mReplaySyncMatched;
+	unsigned int		mReplaySyncDropped;
+	QList<unsigned long>	mReplayLag;		// msec, one per injected event
+	bool			mReplayReported;
+
+	// Out of process controller, see controller.cpp
+	int			mControllerListen;
+	int			mControllerFd;
+	FILE *			mControllerOut;		// writes to mControllerOutput
+	QSocketNotifier *	mControllerAcceptNotifier;
+	QSocketNotifier *	mControllerReadNotifier;
+	QSocketNotifier *	mControllerWriteNotifier;
+	QByteArray		mControllerInput;
+	QByteArray		mControllerOutput;	// what the socket didn't take yet
+	unsigned int		mControllerSeq;
+	unsigned int		mControllerQueued;
+
+	// Object paths interned for compact records
+	PathTable *		mPaths;
+	EventExporter *		mExporter;
+	FlightRecorder *	mFlight;
+
+	// PUPPETEER_WATCHDOG
+	Watchdog *		mWatchdog;
+	QTimer			mWatchdogTimer;
+
+	// PUPPETEER_EVENT_PROFILE
+	EventProfile *		mProfile;
+	unsigned int		mProfileTop;
+
+	// PUPPETEER_PERF, see perfcounters.cpp
+	struct PerfStep {
+		QString		script;
+		unsigned int	step;
+		const char *	action;
+		const char *	status;
+		QVector<quint64> delta;
+	};
+
+	PerfCounters *		mPerf;
+	QVector<quint64>	mPerfLast;
+	QList<PerfStep>		mPerfSteps;
+	// Soak tests add up the same step of every round; by position in the round and step
+	QHash<QPair<int, unsigned int>, int> mPerfStepIndex;
+
+	// PUPPETEER_PROFILE, see sampler.h
+	Sampler *		mSampler;
+	QString			mSamplerDir;
+
+	// PUPPETEER_TRACE, see trace.h
+	TraceWriter *		mTrace;
+	bool			mTraceSlices;		// event handling times, through the notify hook
+	unsigned int		mTraceThreshold;	// usec
+	QString			mTraceScript;
+	qint64			mTraceScriptStart;	// -1 when no script is running
+	quint64			mTraceStepStart;
+	quint64			mTracePerformStart;	// 0 until the timer fires
+	long			mTraceTimeout;		// msec, or -1 if the timer was not armed
+
+	// PUPPETEER_MEMORY, see census.h
+	ObjectCensus *		mCensus;
+	QTimer			mMemoryTimer;
+	long			mMemoryMaxRss;		// KB of growth, or 0
+	int			mMemoryMaxObjects;
+
+	// PUPPETEER_TEST, see testcase.h
+	bool			mTesting;		// the session runs C++ tests rather than scripts
+	QTimer			mTestTimer;		// for the wait the test is in
+	QTimer			mTestCheckTimer;	// looks at properties after things happened
+
+	// PUPPETEER_RECORD=script
+	ScriptRecorder *	mScriptRecorder;
+
+	// PUPPETEER_RECORD=stats
+	EventStats *		mStats;
+	QTimer			mStatsTimer;
+
+	static Puppeteer *	sInstance;
 };
 
 #endif /* QT_PUPPETEER_H */
@@ -0,0 +1,193 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Timed replay of recordings
+//
+//	With PUPPETEER_REPLAY=recording.xml, a recording made by
+//	running the application without PUPPETEER_PLAYBACK is played
+//	back as a load test. Mouse and key events are injected again
+//	at the time they originally happened, relative to the start
+//	of the recording; PUPPETEER_REPLAY_SPEED=2 (or 10, or 0.5)
+//	scales that, and PUPPETEER_REPLAY_SPEED=max injects as fast
+//	as the event loop allows.
+//
+//	Windows showing up serve as synchronization points. Replay
+//	waits for them, but does not fail if they don't show up in
+//	time; they are counted as dropped, and replay moves on.
+//
+//	At the end, we report how far behind schedule the events
+//	were injected, and how many of them and of the
+//	synchronization points did not make it.
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qapplication.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include "puppeteer.h"
+
+bool
+Puppeteer::replayStart(const char *filename)
+{
+	const char *value;
+	Script *script;
+
+	playbackSetup();
+
+	mReplay = true;
+	mReplaySpeed = 1;
+	if ((value = getenv("PUPPETEER_REPLAY_SPEED")) != NULL) {
+		if (!strcmp(value, "max"))
+			mReplaySpeed = 0;
+		else
+		if ((mReplaySpeed = atof(value)) <= 0) {
+			fprintf(stderr, "=== Ignoring invalid replay speed \"%s\"\n", value);
+			mReplaySpeed = 1;
+		}
+	}
+
+	script = new Script;
+	if (!script->loadRecording(filename)) {
+		fprintf(stderr, "Unable to load recording \"%s\"\n", filename);
+		delete script;
+
+		mExitStatus = ExitScriptError;
+		if (mFailurePolicy != FailureContinue) {
+			fflush(stdout);
+			_exit(mExitStatus);
+		}
+		return false;
+	}
+
+	printf("=== Replaying %d actions from %s\n", script->count(), filename);
+
+	gettimeofday(&mScriptStarted, NULL);
+	if ((value = getenv("PUPPETEER_TIMEOUT")) != NULL)
+		mScriptTimer.start(1000 * atoi(value));
+
+	if (mTrace)
+		traceScriptStart(filename);
+
+	mScript = script;
+	if (script->currentAction() == 0) {
+		playbackFinished();
+		return true;
+	}
+
+	playbackDescribeAction(script->currentAction());
+
+	// Waits are satisfied by the event filter; anything else needs a kick
+	if (script->currentAction()->type() != Script::WaitEvent)
+		playbackArmTimer(script->currentAction());
+	return true;
+}
+
+/*
+ * How long until the action is due, in msec. The schedule starts with
+ * the first action we arm, so that application startup doesn't count.
+ * Waits get their usual timeout on top.
+ */
+unsigned long
+Puppeteer::replayDelay(const Script::Action *action)
+{
+	quint64 now = timestampUsec(), due;
+	unsigned long delay = 0;
+
+	if (action->at() < 0)
+		return action->timeout();
+
+	if (mReplayStarted == 0)
+		mReplayStarted = now - (mReplaySpeed? action->at() / mReplaySpeed : 0);
+
+	if (mReplaySpeed) {
+		due = mReplayStarted + (quint64) (action->at() / mReplaySpeed);
+		if (due > now)
+			delay = (due - now) / 1000;
+	}
+
+	if (action->type() == Script::WaitEvent)
+		delay += action->timeout();
+	return delay;
+}
+
+/*
+ * Inject one event of the recording, and note how late we are. A
+ * receiver that does not exist (yet) is not a reason to stop.
+ */
+bool
+Puppeteer::replayEvent(const Script::Action *action)
+{
+	const EventRecord *rec = action->event();
+	quint64 now = timestampUsec(), due;
+
+	if (mReplaySpeed && mReplayStarted) {
+		due = mReplayStarted + (quint64) (action->at() / mReplaySpeed);
+		mReplayLag.append(now > due? (now - due) / 1000 : 0);
+	}
+
+	mReplayReached = action->at();
+
+	if (!objectForRecord(rec)) {
+		printf("=== Replay: receiver not found, skipping event\n");
+		rec->write();
+		mReplayFailed++;
+		return true;
+	}
+
+	if (!playbackEvent(rec))
+		return false;
+
+	mReplayEvents++;
+	return true;
+}
+
+void
+Puppeteer::replayMissed(const Script::Action *action)
+{
+	printf("=== Replay: synchronization point did not show up, moving on\n");
+	action->event()->write();
+	mReplaySyncDropped++;
+}
+
+void
+Puppeteer::replayReport()
+{
+	quint64 elapsed;
+	unsigned long mean = 0, p95 = 0, max = 0;
+	QList<unsigned long> lag = mReplayLag;
+
+	if (mReplayReported)
+		return;
+	mReplayReported = true;
+
+	elapsed = mReplayStarted? timestampUsec() - mReplayStarted : 0;
+
+	if (!lag.isEmpty()) {
+		unsigned long long sum = 0;
+
+		std::sort(lag.begin(), lag.end());
+		for (int i = 0; i < lag.count(); ++i)
+			sum += lag[i];
+		mean = sum / lag.count();
+		p95 = lag[(lag.count() * 95 - 1) / 100];
+		max = lag.last();
+	}
+
+	if (mReplaySpeed)
+		printf("=== Replay report, at %gx speed\n", mReplaySpeed);
+	else
+		printf("=== Replay report, as fast as possible\n");
+	printf("===   Replayed %.3f sec of recording in %.3f sec\n",
+			mReplayReached / 1000000.0, elapsed / 1000000.0);
+	printf("===   Events: %u injected, %u skipped (receiver not found)\n",
+			mReplayEvents, mReplayFailed);
+	if (mReplaySpeed)
+		printf("===   Injection lag: mean %lu msec, 95th percentile %lu msec, max %lu msec\n",
+				mean, p95, max);
+	printf("===   Synchronization points: %u matched, %u dropped\n",
+			mReplaySyncMatched, mReplaySyncDropped);
+	fflush(stdout);
+}
@@ -0,0 +1,601 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Parallel test runner
+//
+//	puppeteer-run [options] script|directory... -- command [args...]
+//
+//	Runs each script through the instrumented application, with
+//	as many workers as there are CPUs. Each worker gets its own
+//	Xvfb display, so the applications do not steal focus from
+//	one another. Scripts are handed out longest first, based on
+//	their durations in previous runs, which keeps the tail of a
+//	run short.
+//
+//	This tool deliberately does not link against Qt.
+//
+//////////////////////////////////////////////////////////////////
+
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/select.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+
+enum Result {
+	Pending, Pass, Fail, Timeout, Crash, ScriptError,
+};
+
+// Exit codes used by Puppeteer after playback; see Puppeteer::ExitStatus
+enum {
+	EXIT_PASS = 0,
+	EXIT_FAIL = 10,
+	EXIT_TIMEOUT = 11,
+	EXIT_SCRIPT_ERROR = 12,
+};
+
+struct Job {
+	std::string	script;
+	std::string	logFile;
+	double		expected;	// from earlier runs, in seconds; < 0 if unknown
+	double		duration;
+	Result		result;
+	int		exitStatus;
+};
+
+struct Worker {
+	int		display;
+	pid_t		xserver;
+	pid_t		child;
+	Job *		job;
+	double		started;
+	bool		terminated;
+};
+
+static unsigned int	opt_jobs;
+static double		opt_timeout = 300;
+static int		opt_display_base = 90;
+static bool		opt_xvfb = true;
+static std::string	opt_outdir = "puppeteer-results";
+static std::string	opt_history = "puppeteer-durations.txt";
+static std::string	opt_xvfb_args = "-screen 0 1280x1024x24 -nolisten tcp";
+
+static const char *	resultNames[] = {
+	"PENDING", "PASS", "FAIL", "TIMEOUT", "CRASH", "BADSCRIPT",
+};
+
+static double
+now()
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void
+usage(int exitval)
+{
+	fprintf(stderr,
+		"Usage: puppeteer-run [options] script|directory... -- command [args...]\n"
+		"Options:\n"
+		"  -j jobs       number of workers (default: number of CPUs)\n"
+		"  -t seconds    per-script timeout (default: 300)\n"
+		"  -o dir        directory for logs and the report (default: puppeteer-results)\n"
+		"  -H file       script duration history (default: puppeteer-durations.txt)\n"
+		"  -d display    first X display number to use (default: 90)\n"
+		"  -X            do not start Xvfb, use $DISPLAY for all workers\n");
+	exit(exitval);
+}
+
+static void
+addScripts(const std::string &path, std::vector<Job> &jobs)
+{
+	struct stat stb;
+
+	if (stat(path.c_str(), &stb) < 0) {
+		perror(path.c_str());
+		exit(1);
+	}
+
+	if (S_ISDIR(stb.st_mode)) {
+		std::vector<std::string> names;
+		struct dirent *d;
+		DIR *dir;
+
+		if ((dir = opendir(path.c_str())) == NULL) {
+			perror(path.c_str());
+			exit(1);
+		}
+		while ((d = readdir(dir)) != NULL) {
+			std::string name(d->d_name);
+
+			if (name.size() > 4 && name.compare(name.size() - 4, 4, ".xml") == 0)
+				names.push_back(path + "/" + name);
+		}
+		closedir(dir);
+
+		std::sort(names.begin(), names.end());
+		for (unsigned int i = 0; i < names.size(); ++i)
+			addScripts(names[i], jobs);
+		return;
+	}
+
+	Job job;
+	job.script = path;
+	job.expected = -1;
+	job.duration = 0;
+	job.result = Pending;
+	job.exitStatus = 0;
+
+	std::string flat(path);
+	std::replace(flat.begin(), flat.end(), '/', '_');
+	job.logFile = opt_outdir + "/" + flat + ".log";
+
+	jobs.push_back(job);
+}
+
+static void
+loadHistory(std::map<std::string, double> &history)
+{
+	char line[4096], name[4096];
+	double duration;
+	FILE *fp;
+
+	if ((fp = fopen(opt_history.c_str(), "r")) == NULL)
+		return;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%lf %4095s", &duration, name) == 2)
+			history[name] = duration;
+	}
+	fclose(fp);
+}
+
+static void
+saveHistory(std::map<std::string, double> &history, const std::vector<Job> &jobs)
+{
+	std::string tmpfile = opt_history + ".new";
+	FILE *fp;
+
+	// Timeouts tell us nothing about how long a script really takes
+	for (unsigned int i = 0; i < jobs.size(); ++i) {
+		if (jobs[i].result != Pending && jobs[i].result != Timeout)
+			history[jobs[i].script] = jobs[i].duration;
+	}
+
+	if ((fp = fopen(tmpfile.c_str(), "w")) == NULL) {
+		perror(tmpfile.c_str());
+		return;
+	}
+	for (std::map<std::string, double>::const_iterator it = history.begin(); it != history.end(); ++it)
+		fprintf(fp, "%.3f %s\n", it->second, it->first.c_str());
+	if (fclose(fp) == 0)
+		rename(tmpfile.c_str(), opt_history.c_str());
+}
+
+// Longest first; scripts we know nothing about go to the front
+static bool
+longestFirst(const Job *a, const Job *b)
+{
+	if ((a->expected < 0) != (b->expected < 0))
+		return a->expected < 0;
+	return a->expected > b->expected;
+}
+
+/*
+ * Start an Xvfb server, and wait until it accepts connections. An
+ * existing socket in /tmp/.X11-unix proves nothing (it may be left
+ * over, or belong to a server that is still starting up), so Xvfb
+ * writes the display number to a pipe with -displayfd once it's ready.
+ */
+static pid_t
+startXvfb(int display)
+{
+	char displayName[16], buffer[16];
+	int pipefd[2], waited, n;
+	pid_t pid;
+
+	snprintf(displayName, sizeof(displayName), ":%d", display);
+
+	if (pipe(pipefd) < 0) {
+		perror("pipe");
+		return -1;
+	}
+
+	if ((pid = fork()) < 0) {
+		perror("fork");
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return -1;
+	}
+
+	if (pid == 0) {
+		char displayFd[16];
+		std::string cmd;
+		int fd;
+
+		close(pipefd[0]);
+		snprintf(displayFd, sizeof(displayFd), "%d", pipefd[1]);
+		cmd = std::string("exec Xvfb ") + displayName + " -displayfd " + displayFd + " " + opt_xvfb_args;
+
+		if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+			dup2(fd, 1);
+			dup2(fd, 2);
+			close(fd);
+		}
+		setpgid(0, 0);
+		execl("/bin/sh", "sh", "-c", cmd.c_str(), (char *) NULL);
+		_exit(127);
+	}
+	close(pipefd[1]);
+
+	// Wait for the server to come up; if it exits, we read EOF
+	for (waited = 0, n = -1; waited < 5000; waited += 50) {
+		struct timeval tv = { 0, 50000 };
+		fd_set fds;
+
+		FD_ZERO(&fds);
+		FD_SET(pipefd[0], &fds);
+		if (select(pipefd[0] + 1, &fds, NULL, NULL, &tv) < 0 && errno != EINTR)
+			break;
+		if (FD_ISSET(pipefd[0], &fds)) {
+			n = read(pipefd[0], buffer, sizeof(buffer) - 1);
+			break;
+		}
+	}
+	close(pipefd[0]);
+
+	if (n > 0)
+		return pid;
+
+	if (n == 0) {
+		// Such as when another server has the display already
+		fprintf(stderr, "Xvfb on display %s exited prematurely\n", displayName);
+		waitpid(pid, NULL, 0);
+		return -1;
+	}
+
+	fprintf(stderr, "Xvfb on display %s did not start up\n", displayName);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return -1;
+}
+
+static pid_t
+startJob(Worker &w, Job *job, char **command)
+{
+	pid_t pid;
+
+	if ((pid = fork()) < 0) {
+		perror("fork");
+		return -1;
+	}
+
+	if (pid == 0) {
+		int fd;
+
+		if ((fd = open(job->logFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+			perror(job->logFile.c_str());
+			_exit(127);
+		}
+		dup2(fd, 1);
+		dup2(fd, 2);
+		close(fd);
+
+		if ((fd = open("/dev/null", O_RDONLY)) >= 0) {
+			dup2(fd, 0);
+			close(fd);
+		}
+
+		if (opt_xvfb) {
+			char displayName[16];
+
+			snprintf(displayName, sizeof(displayName), ":%d", w.display);
+			setenv("DISPLAY", displayName, 1);
+		}
+		setenv("PUPPETEER_PLAYBACK", job->script.c_str(), 1);
+
+		// Let the application time out by itself first, so that we get its diagnostics
+		if (getenv("PUPPETEER_TIMEOUT") == NULL) {
+			char timeout[32];
+
+			// In whole seconds, and 0 would time out right away
+			snprintf(timeout, sizeof(timeout), "%d", opt_timeout > 10? (int) opt_timeout - 5 : (int) opt_timeout);
+			if (atoi(timeout) > 0)
+				setenv("PUPPETEER_TIMEOUT", timeout, 1);
+		}
+
+		// Own process group, so that a timeout kills everything the app spawned
+		setpgid(0, 0);
+		execvp(command[0], command);
+		perror(command[0]);
+		_exit(127);
+	}
+
+	setpgid(pid, pid);
+	w.child = pid;
+	w.job = job;
+	w.started = now();
+	w.terminated = false;
+	return pid;
+}
+
+static void
+jobDone(Worker &w, int status)
+{
+	Job *job = w.job;
+
+	job->duration = now() - w.started;
+	if (w.terminated) {
+		job->result = Timeout;
+	} else
+	if (WIFSIGNALED(status)) {
+		job->result = Crash;
+		job->exitStatus = 128 + WTERMSIG(status);
+	} else {
+		job->exitStatus = WEXITSTATUS(status);
+		switch (job->exitStatus) {
+		case EXIT_PASS:
+			job->result = Pass;
+			break;
+		case EXIT_TIMEOUT:
+			job->result = Timeout;
+			break;
+		case EXIT_SCRIPT_ERROR:
+			job->result = ScriptError;
+			break;
+		default:
+			// EXIT_FAIL, or the application bailed out by itself
+			job->result = Fail;
+		}
+	}
+
+	printf("%-8s %7.2fs  %s\n", resultNames[job->result], job->duration, job->script.c_str());
+	fflush(stdout);
+
+	// Anything the application left behind in its process group goes, too
+	kill(-w.child, SIGKILL);
+	w.child = 0;
+	w.job = 0;
+}
+
+static void
+writeReport(const std::vector<Job> &jobs, double wallTime)
+{
+	std::string path = opt_outdir + "/report.txt";
+	unsigned int count[6] = { 0, 0, 0, 0, 0, 0 };
+	double total = 0;
+	FILE *fp;
+
+	for (unsigned int i = 0; i < jobs.size(); ++i) {
+		count[jobs[i].result]++;
+		total += jobs[i].duration;
+	}
+
+	if ((fp = fopen(path.c_str(), "w")) == NULL) {
+		perror(path.c_str());
+		fp = stdout;
+	}
+
+	for (unsigned int i = 0; i < jobs.size(); ++i) {
+		const Job &job(jobs[i]);
+
+		fprintf(fp, "%-8s %7.2fs  exit=%-3d %s  (log: %s)\n",
+				resultNames[job.result], job.duration, job.exitStatus,
+				job.script.c_str(), job.logFile.c_str());
+	}
+	fprintf(fp, "\n");
+	fprintf(fp, "%zu scripts: %u passed, %u failed, %u timed out, %u crashed, %u bad scripts\n",
+			jobs.size(), count[Pass], count[Fail], count[Timeout], count[Crash], count[ScriptError]);
+	fprintf(fp, "Wall time %.1fs, script time %.1fs, %u workers (speedup %.1fx)\n",
+			wallTime, total, opt_jobs, wallTime > 0? total / wallTime : 0);
+
+	if (fp != stdout) {
+		fclose(fp);
+		printf("\n%zu scripts: %u passed, %u failed, %u timed out, %u crashed, %u bad scripts; wall time %.1fs (speedup %.1fx)\n",
+				jobs.size(), count[Pass], count[Fail], count[Timeout], count[Crash], count[ScriptError],
+				wallTime, wallTime > 0? total / wallTime : 0);
+		printf("Report written to %s\n", path.c_str());
+	}
+}
+
+static volatile sig_atomic_t	interrupted;
+
+static void
+interruptHandler(int sig)
+{
+	interrupted = 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	std::map<std::string, double> history;
+	std::vector<Job> jobs;
+	std::vector<Job *> queue;
+	std::vector<Worker> workers;
+	char **command = NULL;
+	double startTime;
+	unsigned int running = 0;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "+d:hH:j:o:t:X")) != -1) {
+		switch (c) {
+		case 'd':
+			opt_display_base = atoi(optarg);
+			break;
+		case 'H':
+			opt_history = optarg;
+			break;
+		case 'j':
+			opt_jobs = atoi(optarg);
+			break;
+		case 'o':
+			opt_outdir = optarg;
+			break;
+		case 't':
+			if ((opt_timeout = atof(optarg)) <= 0) {
+				fprintf(stderr, "Invalid timeout \"%s\"\n", optarg);
+				usage(1);
+			}
+			break;
+		case 'X':
+			opt_xvfb = false;
+			break;
+		case 'h':
+			usage(0);
+		default:
+			usage(1);
+		}
+	}
+
+	if (opt_jobs == 0) {
+		long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		opt_jobs = (ncpus > 0)? ncpus : 1;
+	}
+
+	if (mkdir(opt_outdir.c_str(), 0755) < 0 && errno != EEXIST) {
+		perror(opt_outdir.c_str());
+		return 1;
+	}
+
+	for (i = optind; i < argc; ++i) {
+		if (!strcmp(argv[i], "--")) {
+			command = argv + i + 1;
+			break;
+		}
+		addScripts(argv[i], jobs);
+	}
+
+	if (command == NULL || *command == NULL || jobs.empty())
+		usage(1);
+
+	loadHistory(history);
+	for (unsigned int j = 0; j < jobs.size(); ++j) {
+		std::map<std::string, double>::const_iterator it = history.find(jobs[j].script);
+
+		if (it != history.end())
+			jobs[j].expected = it->second;
+		queue.push_back(&jobs[j]);
+	}
+	std::stable_sort(queue.begin(), queue.end(), longestFirst);
+	std::reverse(queue.begin(), queue.end());
+
+	if (opt_jobs > jobs.size())
+		opt_jobs = jobs.size();
+
+	signal(SIGINT, interruptHandler);
+	signal(SIGTERM, interruptHandler);
+
+	for (unsigned int j = 0; j < opt_jobs; ++j) {
+		Worker w;
+
+		w.display = opt_display_base + j;
+		w.xserver = 0;
+		w.child = 0;
+		w.job = 0;
+		w.started = 0;
+		w.terminated = false;
+
+		if (opt_xvfb && (w.xserver = startXvfb(w.display)) < 0)
+			continue;
+		workers.push_back(w);
+	}
+
+	if (workers.empty()) {
+		fprintf(stderr, "No workers could be started\n");
+		return 1;
+	}
+
+	startTime = now();
+	while (!interrupted && (!queue.empty() || running)) {
+		int status;
+		pid_t pid;
+
+		for (unsigned int j = 0; j < workers.size() && !queue.empty(); ++j) {
+			Worker &w(workers[j]);
+
+			if (w.child)
+				continue;
+
+			if (opt_xvfb && w.xserver <= 0 && (w.xserver = startXvfb(w.display)) < 0)
+				continue;
+
+			if (startJob(w, queue.back(), command) > 0) {
+				queue.pop_back();
+				running++;
+			}
+		}
+
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			for (unsigned int j = 0; j < workers.size(); ++j) {
+				Worker &w(workers[j]);
+
+				if (w.child == pid) {
+					jobDone(w, status);
+					running--;
+				} else
+				if (w.xserver == pid) {
+					fprintf(stderr, "Xvfb on display :%d died, restarting it\n", w.display);
+					w.xserver = 0;
+				}
+			}
+		}
+
+		for (unsigned int j = 0; j < workers.size(); ++j) {
+			Worker &w(workers[j]);
+			double elapsed;
+
+			if (w.child == 0)
+				continue;
+
+			elapsed = now() - w.started;
+			if (!w.terminated && elapsed > opt_timeout) {
+				kill(-w.child, SIGTERM);
+				w.terminated = true;
+			} else
+			if (w.terminated && elapsed > opt_timeout + 5) {
+				kill(-w.child, SIGKILL);
+			}
+		}
+
+		usleep(20000);
+	}
+
+	for (unsigned int j = 0; j < workers.size(); ++j) {
+		Worker &w(workers[j]);
+
+		if (w.child) {
+			kill(-w.child, SIGKILL);
+			waitpid(w.child, NULL, 0);
+		}
+		if (w.xserver > 0) {
+			kill(w.xserver, SIGTERM);
+			waitpid(w.xserver, NULL, 0);
+		}
+	}
+
+	writeReport(jobs, now() - startTime);
+	saveHistory(history, jobs);
+
+	for (unsigned int j = 0; j < jobs.size(); ++j) {
+		if (jobs[j].result != Pass)
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,236 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Sampling profiler
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qhash.h>
+#include <qmap.h>
+#include <qvector.h>
+#include <qfile.h>
+#include <qdir.h>
+#include <qregexp.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "sampler.h"
+#include "stack.h"
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id	_sigev_un._tid
+#endif
+
+enum { MaxFrames = 64 };
+
+static Sampler *	theSampler;
+
+Sampler::Sampler()
+: mBuffer(0), mSize(0), mUsed(0), mStep(0), mSamples(0), mDropped(0), mRunning(false)
+{
+}
+
+Sampler::~Sampler()
+{
+	stop();
+	free(mBuffer);
+}
+
+bool
+Sampler::start(unsigned int hz, unsigned int bufferMB)
+{
+	struct sigaction sa;
+	struct sigevent sev;
+	struct itimerspec its;
+	clockid_t clock;
+
+	if (!stackCaptureInit())
+		return false;
+
+	mSize = (size_t) bufferMB * 1024 * 1024 / sizeof(quintptr);
+	if ((mBuffer = (quintptr *) malloc(mSize * sizeof(quintptr))) == NULL) {
+		perror("malloc");
+		return false;
+	}
+
+	// Only count the time the GUI thread is actually running
+	if (pthread_getcpuclockid(pthread_self(), &clock) != 0)
+		clock = CLOCK_THREAD_CPUTIME_ID;
+
+	theSampler = this;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = signalHandler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART | SA_SIGINFO;
+	sigaction(SIGPROF, &sa, NULL);
+
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGPROF;
+	sev.sigev_notify_thread_id = syscall(SYS_gettid);
+	if (timer_create(clock, &sev, &mTimer) < 0) {
+		perror("timer_create");
+		return false;
+	}
+
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = hz > 1? 0 : 1;
+	its.it_interval.tv_nsec = hz > 1? 1000000000 / hz : 0;
+	its.it_value = its.it_interval;
+	timer_settime(mTimer, 0, &its, NULL);
+
+	mRunning = true;
+	return true;
+}
+
+void
+Sampler::stop()
+{
+	if (!mRunning)
+		return;
+
+	timer_delete(mTimer);
+	signal(SIGPROF, SIG_IGN);
+	mRunning = false;
+}
+
+void
+Sampler::signalHandler(int, siginfo_t *, void *context)
+{
+	int saved = errno;
+
+	if (theSampler)
+		theSampler->takeSample(context);
+	errno = saved;
+}
+
+/*
+ * In the signal handler: no allocations, no locks
+ */
+void
+Sampler::takeSample(const void *context)
+{
+	void *frames[MaxFrames];
+	int count;
+
+	// Leave out ourselves, the handler and the signal trampoline
+	count = stackCaptureInterrupted(frames, MaxFrames, context, 4);
+
+	if (mUsed + 2 + count > mSize) {
+		mDropped++;
+		return;
+	}
+
+	mBuffer[mUsed] = mStep;
+	mBuffer[mUsed + 1] = count;
+	memcpy(mBuffer + mUsed + 2, frames, count * sizeof(void *));
+	mUsed += 2 + count;
+	mSamples++;
+}
+
+void
+Sampler::stepDone(const QString &label)
+{
+	// Later rounds of a soak test keep the labels of the first
+	if (mStep == mLabels.count())
+		mLabels.append(label);
+	mStep = mStep + 1;
+}
+
+static QString
+foldedName(const QString &name)
+{
+	QString result = name;
+
+	// Semicolons separate frames
+	return result.replace(';', ':');
+}
+
+bool
+Sampler::write(const QString &dirName)
+{
+	QVector<QMap<QString, unsigned long> > steps;
+	QHash<quintptr, QString> names;
+	QVector<void *> unknown;
+	QStringList symbols;
+	QFile all;
+	QDir dir;
+	size_t pos;
+	bool ok = true;
+
+	stop();
+
+	if (!dir.mkpath(dirName)) {
+		fprintf(stderr, "=== Cannot create directory %s\n", qPrintable(dirName));
+		return false;
+	}
+	dir.setPath(dirName);
+
+	// Look up every address only once
+	for (pos = 0; pos < mUsed; pos += 2 + mBuffer[pos + 1]) {
+		for (quintptr i = 0; i < mBuffer[pos + 1]; ++i) {
+			quintptr addr = mBuffer[pos + 2 + i];
+
+			if (!names.contains(addr)) {
+				names.insert(addr, QString());
+				unknown.append((void *) addr);
+			}
+		}
+	}
+	symbols = stackSymbolize(unknown.data(), unknown.count());
+	for (int i = 0; i < symbols.count(); ++i)
+		names[(quintptr) unknown[i]] = foldedName(symbols[i]);
+
+	// Outermost frame first
+	steps.resize(mLabels.count() + 1);
+	for (pos = 0; pos < mUsed; pos += 2 + mBuffer[pos + 1]) {
+		quintptr step = mBuffer[pos], count = mBuffer[pos + 1];
+		QStringList stack;
+
+		for (quintptr i = count; i > 0; --i)
+			stack.append(names.value(mBuffer[pos + 1 + i]));
+		steps[step][stack.join(";")]++;
+	}
+
+	all.setFileName(dir.filePath("all.folded"));
+	if (!all.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		fprintf(stderr, "=== Cannot write %s\n", qPrintable(all.fileName()));
+		return false;
+	}
+
+	for (int step = 0; step < steps.count(); ++step) {
+		const QMap<QString, unsigned long> &stacks = steps[step];
+		QString label = (step < mLabels.count())? mLabels[step] : QString("after-script");
+		QString root = QString("step %1 %2").arg(step + 1).arg(foldedName(label));
+		QString fileName;
+		QFile file;
+
+		if (stacks.isEmpty())
+			continue;
+
+		fileName.sprintf("%03d-", step + 1);
+		fileName += QString(label).replace(QRegExp("[^A-Za-z0-9_.-]+"), "_") + ".folded";
+		file.setFileName(dir.filePath(fileName));
+		if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+			fprintf(stderr, "=== Cannot write %s\n", qPrintable(file.fileName()));
+			ok = false;
+			continue;
+		}
+
+		for (QMap<QString, unsigned long>::const_iterator it = stacks.begin(); it != stacks.end(); ++it) {
+			QByteArray count = " " + QByteArray::number((qulonglong) it.value()) + "\n";
+
+			file.write(it.key().toUtf8() + count);
+			all.write((root + ";" + it.key()).toUtf8() + count);
+		}
+		file.close();
+	}
+	all.close();
+
+	return ok;
+}
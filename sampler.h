@@ -0,0 +1,61 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Sampling profiler
+//
+//	A timer on the CPU clock of the GUI thread sends it SIGPROF
+//	every so often, and the handler stores the stack trace
+//	along with the number of the script step that was current
+//	at the time. Samples go into a buffer allocated up front;
+//	nothing is looked at until the end, when they are written
+//	out as folded stacks, one file per step, which is what
+//	flamegraph.pl and most other flame graph tools read.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_SAMPLER_H
+#define PUPPETEER_SAMPLER_H
+
+#include <qstring.h>
+#include <qstringlist.h>
+#include <signal.h>
+#include <time.h>
+
+class Sampler {
+public:
+	Sampler();
+	~Sampler();
+
+	bool			start(unsigned int hz, unsigned int bufferMB);
+	void			stop();
+
+	// The current step is over; samples from now on go to the next one
+	void			stepDone(const QString &label);
+	// Another round of a soak test; its steps add up with those of the first
+	void			rewind() { mStep = 0; }
+
+	// Write <dir>/NNN-label.folded for each step, and <dir>/all.folded
+	bool			write(const QString &dir);
+
+	unsigned long		samples() const { return mSamples; }
+	unsigned long		dropped() const { return mDropped; }
+
+private:
+	static void		signalHandler(int, siginfo_t *, void *context);
+	void			takeSample(const void *context);
+
+	// Each sample is: step, number of frames, frames
+	quintptr *		mBuffer;
+	size_t			mSize;
+	size_t			mUsed;
+
+	volatile sig_atomic_t	mStep;
+	unsigned long		mSamples;
+	unsigned long		mDropped;
+
+	QStringList		mLabels;
+
+	bool			mRunning;
+	timer_t			mTimer;
+};
+
+#endif /* PUPPETEER_SAMPLER_H */
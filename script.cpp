@@ -23,10 +23,19 @@
 #include "namespace.h"
 
 
+enum {
+	MaxCallDepth = 1000,
+
+	// Instructions without coming across an action; surely a loop that never ends
+	MaxRunLength = 10000000,
+};
+
 Script::Action::~Action()
 {
 	if (mEventRecord)
 		delete mEventRecord;
+	if (mTemplate)
+		delete mTemplate;
 }
 
 unsigned long
@@ -45,15 +54,43 @@ Script::Action::timeout() const
 
 	case SendEvent:
 	case SetFocus:
+	case Click:
+	case TypeText:
 		/* Before sending an event, allow things to settle for .5 sec */
 		return 500;
 
+	case Condition:
+		/* The condition looks at what the last action did; same as for events */
+		return 500;
+
 	default:
 		/* All else: 1 sec */
 		return 1000;
 	}
 }
 
+/*
+ * The element name of the action in a script
+ */
+const char *
+Script::Action::name() const
+{
+	switch (mType) {
+	case WaitApplicationExit:	return "wait-application-exit";
+	case WaitEvent:			return "wait-event";
+	case SendEvent:			return "send-event";
+	case SetFocus:			return "set-focus";
+	case VerifyProperties:		return "verify";
+	case VerifySnapshot:		return "verify-snapshot";
+	case VerifyImage:		return "verify-image";
+	case TakeSnapshot:		return "snapshot";
+	case Click:			return "click";
+	case TypeText:			return "type-text";
+	case Condition:			return "condition";
+	}
+	return "unknown";
+}
+
 Script::Action *
 Script::Action::waitApplicationExit()
 {
@@ -84,25 +121,330 @@ Script::Action::verifyProperties(EventRecord *record)
 	return new Action(VerifyProperties, record);
 }
 
+Script::Action *
+Script::Action::verifySnapshot(EventRecord *record)
+{
+	return new Action(VerifySnapshot, record);
+}
+
+Script::Action *
+Script::Action::verifyImage(EventRecord *record)
+{
+	return new Action(VerifyImage, record);
+}
+
+Script::Action *
+Script::Action::takeSnapshot(EventRecord *record)
+{
+	return new Action(TakeSnapshot, record);
+}
+
+Script::Action *
+Script::Action::click(EventRecord *record)
+{
+	return new Action(Click, record);
+}
+
+Script::Action *
+Script::Action::typeText(EventRecord *record)
+{
+	return new Action(TypeText, record);
+}
+
+Script::Action *
+Script::Action::condition(EventRecord *record)
+{
+	return new Action(Condition, record);
+}
+
+static bool
+hasVariables(const RecordNode *node)
+{
+	const Attribute::list &attrs = node->attributes();
+	const RecordNode::list &children = node->children();
+
+	for (int i = 0; i < attrs.count(); ++i) {
+		if (attrs[i].value.contains("${"))
+			return true;
+	}
+	for (int i = 0; i < children.count(); ++i) {
+		if (hasVariables(children[i]))
+			return true;
+	}
+	return false;
+}
+
+void
+Script::Action::makeTemplate()
+{
+	if (mEventRecord == 0 || !hasVariables(mEventRecord))
+		return;
+
+	mTemplate = mEventRecord;
+	mEventRecord = 0;
+}
+
+static void
+copySubstituted(const Script *script, const RecordNode *from, RecordNode *to)
+{
+	const Attribute::list &attrs = from->attributes();
+	const RecordNode::list &children = from->children();
+
+	for (int i = 0; i < attrs.count(); ++i) {
+		if (attrs[i].name != "type")
+			to->addAttribute(attrs[i].name, script->substitute(attrs[i].value));
+	}
+	for (int i = 0; i < children.count(); ++i)
+		copySubstituted(script, children[i], to->addChild(children[i]->name()));
+}
+
+void
+Script::Action::bind(const Script *script)
+{
+	if (mTemplate == 0)
+		return;
+
+	if (mEventRecord)
+		delete mEventRecord;
+
+	// Keep the type attribute first, and absent if it was
+	mEventRecord = new EventRecord(script->substitute(mTemplate->attribute("type")));
+	if (mTemplate->attribute("type").isNull())
+		mEventRecord->removeAttribute("type");
+	copySubstituted(script, mTemplate, mEventRecord);
+}
+
+bool
+Script::Action::wantsSync() const
+{
+	const EventRecord *rec = mTemplate? mTemplate : mEventRecord;
+	QString sync;
+
+	if (rec)
+		sync = rec->attribute("sync");
+	return !sync.isEmpty() && sync != "false";
+}
+
+Script::Script()
+: mPc(0), mReady(false), mCondition(false), mFailed(false)
+{
+}
+
 Script::~Script()
 {
 	while (!mActions.isEmpty())
 		delete mActions.takeFirst();
+	while (!mOperands.isEmpty())
+		delete mOperands.takeFirst();
 }
 
+/*
+ * Move on from the current action. Actions stay around; a loop may
+ * come by them again.
+ */
 void
 Script::actionDone()
 {
-	if (!mActions.isEmpty())
-		delete mActions.takeFirst();
+	if (currentAction() == 0)
+		return;
+
+	if (mCode[mPc].op == OpTest && !mCondition)
+		mPc = mCode[mPc].b;
+	else
+		mPc++;
+	mReady = false;
+}
+
+bool
+Script::hasSyncActions() const
+{
+	for (int i = 0; i < mActions.count(); ++i) {
+		if (mActions[i]->wantsSync())
+			return true;
+	}
+	return false;
+}
+
+int
+Script::count() const
+{
+	int count = 0;
+
+	for (int pc = mPc; pc < mCode.count(); ++pc) {
+		if (mCode[pc].op == OpAction || mCode[pc].op == OpTest)
+			count++;
+	}
+	return count;
 }
 
 Script::Action *
-Script::currentAction() const
+Script::currentAction()
 {
-	if (mActions.isEmpty())
+	// Code appended by a controller picks up where we ran out
+	if (!mReady && !mFailed)
+		mReady = run();
+
+	if (!mReady)
 		return 0;
-	return mActions.first();
+	return mActions[mCode[mPc].a];
+}
+
+/*
+ * Execute instructions up to the next action
+ */
+bool
+Script::run()
+{
+	const EventRecord *operand;
+	QString name;
+	int steps = 0, n;
+
+	while (mPc < mCode.count()) {
+		const Instruction &ins = mCode[mPc];
+
+		if (++steps > MaxRunLength) {
+			error("Script keeps running without performing any action");
+			return false;
+		}
+
+		switch (ins.op) {
+		case OpAction:
+		case OpTest:
+			mActions[ins.a]->bind(this);
+			mCondition = false;
+			return true;
+
+		case OpBranch:
+			mPc = evaluate(mOperands[ins.a])? mPc + 1 : ins.b;
+			break;
+
+		case OpJump:
+			mPc = ins.a;
+			break;
+
+		case OpSet:
+			operand = mOperands[ins.a];
+			name = operand->attribute("var");
+			if (!operand->attribute("add").isNull())
+				mVariables[name] = QString::number(mVariables.value(name).toLongLong()
+							+ substitute(operand->attribute("add")).toLongLong());
+			else
+				mVariables[name] = substitute(operand->attribute("value"));
+			mPc++;
+			break;
+
+		case OpRepeat:
+			operand = mOperands[ins.a];
+			if ((n = substitute(operand->attribute("count")).toInt()) <= 0) {
+				mPc = ins.b;
+				break;
+			}
+
+			mLoops.resize(mLoops.count() + 1);
+			mLoops.last().remaining = n;
+			mLoops.last().index = 1;
+			if (!operand->attribute("var").isEmpty())
+				mVariables[operand->attribute("var")] = "1";
+			mPc++;
+			break;
+
+		case OpNext:
+			if (--mLoops.last().remaining <= 0) {
+				mLoops.resize(mLoops.count() - 1);
+				mPc++;
+				break;
+			}
+
+			operand = mOperands[ins.b];
+			if (!operand->attribute("var").isEmpty())
+				mVariables[operand->attribute("var")] = QString::number(++mLoops.last().index);
+			mPc = ins.a;
+			break;
+
+		case OpCall:
+			if (mCalls.count() >= MaxCallDepth) {
+				error("Subroutine calls nested too deeply");
+				return false;
+			}
+
+			// Anything but the name is a variable to set
+			operand = mOperands[ins.b];
+			for (int i = 0; i < operand->attributes().count(); ++i) {
+				const Attribute &attr = operand->attributes()[i];
+
+				if (attr.name != "name")
+					mVariables[attr.name] = substitute(attr.value);
+			}
+
+			mCalls.append(mPc + 1);
+			mPc = ins.a;
+			break;
+
+		case OpReturn:
+			mPc = mCalls.last();
+			mCalls.resize(mCalls.count() - 1);
+			break;
+		}
+	}
+
+	return false;
+}
+
+void
+Script::error(const QString &message)
+{
+	fprintf(stderr, "=== %s, at instruction %d of %d\n", qPrintable(message), mPc, mCode.count());
+	mFailed = true;
+}
+
+/*
+ * Replace ${name} by the value of the variable
+ */
+QString
+Script::substitute(const QString &text) const
+{
+	QString result;
+	int pos = 0, start, end;
+
+	while ((start = text.indexOf("${", pos)) >= 0
+	    && (end = text.indexOf('}', start + 2)) >= 0) {
+		result += text.mid(pos, start - pos);
+		result += mVariables.value(text.mid(start + 2, end - start - 2));
+		pos = end + 1;
+	}
+
+	if (pos == 0)
+		return text;
+	return result + text.mid(pos);
+}
+
+/*
+ * Conditions say value="..." for equal, not="..." for different,
+ * and less="..." or greater="..." for numbers. All given must hold.
+ */
+bool
+Script::compare(const QString &actual, const RecordNode *condition) const
+{
+	QString value;
+
+	if (!(value = condition->attribute("value")).isNull() && actual != substitute(value))
+		return false;
+	if (!(value = condition->attribute("not")).isNull() && actual == substitute(value))
+		return false;
+	if (!(value = condition->attribute("less")).isNull() && !(actual.toDouble() < substitute(value).toDouble()))
+		return false;
+	if (!(value = condition->attribute("greater")).isNull() && !(actual.toDouble() > substitute(value).toDouble()))
+		return false;
+	return true;
+}
+
+/*
+ * Conditions on variables, which don't need the application
+ */
+bool
+Script::evaluate(const RecordNode *condition) const
+{
+	return compare(mVariables.value(condition->attribute("var")), condition);
 }
 
 bool
@@ -125,6 +467,231 @@ Script::Action::matchCurrentEvent(const EventRecord *rec) const
 	return true;
 }
 
+/*
+ * Convert one script element into an action; returns NULL if the
+ * element is not understood.
+ */
+Script::Action *
+Script::parseAction(const QDomElement &e)
+{
+	/* Check what type of element we have */
+	if (e.tagName() == "wait-application-exit")
+		return Action::waitApplicationExit();
+
+	if (e.tagName() == "wait-event")
+		return Action::waitEvent(new EventRecord(e));
+
+	if (e.tagName() == "send-event")
+		return Action::sendEvent(new EventRecord(e));
+
+	if (e.tagName() == "set-focus")
+		return Action::setFocus(new EventRecord(e));
+
+	if (e.tagName() == "verify")
+		return Action::verifyProperties(new EventRecord(e));
+
+	if (e.tagName() == "verify-snapshot")
+		return Action::verifySnapshot(new EventRecord(e));
+
+	if (e.tagName() == "verify-image")
+		return Action::verifyImage(new EventRecord(e));
+
+	if (e.tagName() == "snapshot")
+		return Action::takeSnapshot(new EventRecord(e));
+
+	if (e.tagName() == "click")
+		return Action::click(new EventRecord(e));
+
+	if (e.tagName() == "type-text")
+		return Action::typeText(new EventRecord(e));
+
+	fprintf(stderr, "Unexpected element <%s> in script\n", qPrintable(e.tagName()));
+	return 0;
+}
+
+int
+Script::addInstruction(Opcode op, int a, int b)
+{
+	Instruction ins;
+
+	ins.op = op;
+	ins.a = a;
+	ins.b = b;
+	mCode.append(ins);
+	return mCode.count() - 1;
+}
+
+/*
+ * Keep the attributes of a control element, without its body
+ */
+int
+Script::addOperand(const QDomElement &e)
+{
+	mOperands.append(new EventRecord(e.cloneNode(false).toElement()));
+	return mOperands.count() - 1;
+}
+
+/*
+ * Emit the test for <while> and <if>, with the jump target left open.
+ * Conditions on variables are for us; conditions on objects need to
+ * be checked by the application in due time, like any other action.
+ */
+bool
+Script::compileCondition(const QDomElement &e)
+{
+	Action *action;
+
+	if (e.hasAttribute("var")) {
+		addInstruction(OpBranch, addOperand(e));
+		return true;
+	}
+
+	if (!e.hasAttribute("objectPath")) {
+		fprintf(stderr, "<%s> needs a var or objectPath attribute\n", qPrintable(e.tagName()));
+		return false;
+	}
+
+	action = Action::condition(new EventRecord(e.cloneNode(false).toElement()));
+	action->makeTemplate();
+	mActions.append(action);
+	addInstruction(OpTest, mActions.count() - 1);
+	return true;
+}
+
+bool
+Script::compileElement(const QDomElement &e)
+{
+	int start, test, jump;
+	Action *action;
+
+	if (e.tagName() == "set") {
+		addInstruction(OpSet, addOperand(e));
+		return true;
+	}
+
+	if (e.tagName() == "repeat") {
+		start = addInstruction(OpRepeat, addOperand(e));
+		if (!compileElements(e))
+			return false;
+		addInstruction(OpNext, start + 1, mCode[start].a);
+		mCode[start].b = mCode.count();
+		return true;
+	}
+
+	if (e.tagName() == "while") {
+		test = mCode.count();
+		if (!compileCondition(e) || !compileElements(e))
+			return false;
+		addInstruction(OpJump, test);
+		mCode[test].b = mCode.count();
+		return true;
+	}
+
+	if (e.tagName() == "if") {
+		QDomElement other = e.firstChildElement("else");
+
+		test = mCode.count();
+		if (!compileCondition(e) || !compileElements(e))
+			return false;
+		if (other.isNull()) {
+			mCode[test].b = mCode.count();
+			return true;
+		}
+
+		jump = addInstruction(OpJump);
+		mCode[test].b = mCode.count();
+		if (!compileElements(other))
+			return false;
+		mCode[jump].a = mCode.count();
+		return true;
+	}
+
+	if (e.tagName() == "sub") {
+		if (e.attribute("name").isEmpty() || mSubs.contains(e.attribute("name"))) {
+			fprintf(stderr, "<sub> without a name, or with one that is taken\n");
+			return false;
+		}
+
+		jump = addInstruction(OpJump);
+		mSubs.insert(e.attribute("name"), mCode.count());
+		if (!compileElements(e))
+			return false;
+		addInstruction(OpReturn);
+		mCode[jump].a = mCode.count();
+		return true;
+	}
+
+	if (e.tagName() == "call") {
+		mFixups.append(qMakePair(addInstruction(OpCall, 0, addOperand(e)), e.attribute("name")));
+		return true;
+	}
+
+	if ((action = parseAction(e)) == 0)
+		return false;
+
+	action->makeTemplate();
+	mActions.append(action);
+	addInstruction(OpAction, mActions.count() - 1);
+	return true;
+}
+
+/*
+ * Compile all children of the given element; <else> and what follows
+ * is for the caller.
+ */
+bool
+Script::compileElements(const QDomElement &parent)
+{
+	for (QDomElement e = parent.firstChildElement(); !e.isNull(); e = e.nextSiblingElement()) {
+		if (e.tagName() == "else") {
+			if (parent.tagName() != "if") {
+				fprintf(stderr, "<else> outside of <if>\n");
+				return false;
+			}
+			break;
+		}
+
+		if (!compileElement(e))
+			return false;
+	}
+	return true;
+}
+
+/*
+ * Compile all children of the given element. Either all of them are
+ * appended to the script, or none.
+ */
+bool
+Script::appendElements(const QDomElement &docElem)
+{
+	int code = mCode.count(), actions = mActions.count(), operands = mOperands.count();
+	QHash<QString, int> subs = mSubs;
+	bool ok;
+
+	mFixups.clear();
+	ok = compileElements(docElem);
+
+	for (int i = 0; ok && i < mFixups.count(); ++i) {
+		if (!mSubs.contains(mFixups[i].second)) {
+			fprintf(stderr, "Call to unknown subroutine \"%s\"\n", qPrintable(mFixups[i].second));
+			ok = false;
+			break;
+		}
+		mCode[mFixups[i].first].a = mSubs.value(mFixups[i].second);
+	}
+	mFixups.clear();
+
+	if (!ok) {
+		mCode.resize(code);
+		while (mActions.count() > actions)
+			delete mActions.takeLast();
+		while (mOperands.count() > operands)
+			delete mOperands.takeLast();
+		mSubs = subs;
+	}
+	return ok;
+}
+
 bool
 Script::load(const QString &scriptFile)
 {
@@ -140,58 +707,100 @@ Script::load(const QString &scriptFile)
 	}
 	file.close();
 
-	QDomElement docElem = doc.documentElement();
-
-	QDomNode n = docElem.firstChild();
-	while (!n.isNull()) {
-		QDomElement e = n.toElement(); // try to convert the node to an element.
-
-		if (!e.isNull()) {
-			/* Check what type of element we have */
-			if (e.tagName() == "wait-application-exit") {
-				mActions.append(Action::waitApplicationExit());
-			} else
-			if (e.tagName() == "wait-event") {
-				EventRecord *rec = new EventRecord(e);
-
-				if (rec == 0) {
-					fprintf(stderr, "wait-event: cannot process event data\n");
-					return false;
-				}
-				mActions.append(Action::waitEvent(rec));
-			} else
-			if (e.tagName() == "send-event") {
-				EventRecord *rec = new EventRecord(e);
-
-				if (rec == 0) {
-					fprintf(stderr, "send-event: cannot process event data\n");
-					return false;
-				}
-				mActions.append(Action::sendEvent(rec));
-			} else
-			if (e.tagName() == "set-focus") {
-				EventRecord *rec = new EventRecord(e);
-
-				if (rec == 0) {
-					fprintf(stderr, "set-focus: cannot process event data\n");
-					return false;
-				}
-				mActions.append(Action::setFocus(rec));
-			} else
-			if (e.tagName() == "verify") {
-				EventRecord *rec = new EventRecord(e);
-
-				if (rec == 0) {
-					fprintf(stderr, "verify: cannot process data\n");
-					return false;
-				}
-				mActions.append(Action::verifyProperties(rec));
-			} else {
-				fprintf(stderr, "Unexpected element <%s> in script\n", qPrintable(e.tagName()));
-			}
+	return appendElements(doc.documentElement());
+}
+
+/*
+ * Load a recording, as written to stdout when not playing back, for
+ * timed replay. Anything that is not an event record - output of the
+ * application, say - is skipped.
+ *
+ * Key presses and mouse clicks are sent again; windows showing up
+ * become synchronization points. Everything else just happens. Each
+ * action remembers when its event was recorded, relative to the first one.
+ */
+bool
+Script::loadRecording(const QString &filename)
+{
+	QDomDocument doc("recording");
+	QFile file(filename);
+	QByteArray xml;
+	QString errorMsg;
+	int errorLine;
+	bool first = true, activated = false;
+	double t0 = 0;
+
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	xml = "<recording>\n";
+	while (!file.atEnd()) {
+		QByteArray line = file.readLine();
+
+		if (line.trimmed().startsWith('<'))
+			xml += line;
+	}
+	xml += "</recording>\n";
+	file.close();
+
+	if (!doc.setContent(xml, &errorMsg, &errorLine)) {
+		fprintf(stderr, "Cannot parse recording: %s at line %d\n", qPrintable(errorMsg), errorLine - 1);
+		return false;
+	}
+
+	for (QDomElement e = doc.documentElement().firstChildElement("event");
+	     !e.isNull(); e = e.nextSiblingElement("event")) {
+		QString type = e.attribute("type");
+		EventRecord *rec;
+		Action *action;
+		double t;
+
+		if (type == "MouseButtonPress" || type == "MouseButtonRelease"
+		 || type == "KeyPress" || type == "KeyRelease") {
+			action = Action::sendEvent(rec = new EventRecord(e));
+		} else
+		if (type == "Show" && !e.attribute("objectPath").contains('.')) {
+			action = Action::waitEvent(rec = new EventRecord(e));
+		} else
+		if (type == "ApplicationActivate" && !activated) {
+			activated = true;
+			action = Action::waitEvent(rec = new EventRecord(e));
+		} else {
+			continue;
 		}
-		n = n.nextSibling();
+
+		// Matching the wait-events must not depend on the time
+		t = rec->attribute("timestamp").toDouble();
+		rec->removeAttribute("timestamp");
+
+		if (first)
+			t0 = t;
+		first = false;
+
+		action->setAt((qint64) ((t - t0) * 1000000));
+		mActions.append(action);
+		addInstruction(OpAction, mActions.count() - 1);
 	}
 
 	return true;
 }
+
+/*
+ * Append one or more actions given as XML text, as in
+ *   <send-event ...>...</send-event><wait-event .../>
+ */
+bool
+Script::append(const QString &text)
+{
+	QDomDocument doc("script");
+	QString errorMsg;
+	int errorColumn;
+
+	if (!doc.setContent("<script>" + text + "</script>", &errorMsg, 0, &errorColumn)) {
+		fprintf(stderr, "Cannot parse actions: %s at column %d\n",
+				qPrintable(errorMsg), errorColumn - 8);
+		return false;
+	}
+
+	return appendElements(doc.documentElement());
+}
@@ -0,0 +1,220 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Recording of playable scripts
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qwidget.h>
+#include <qevent.h>
+
+#include "scriptrecorder.h"
+
+ScriptRecorder::ScriptRecorder(FILE *fp)
+: mFile(fp), mFinished(false), mActivated(false), mPress(0), mTextFirst(0)
+{
+	fprintf(mFile, "<script>\n");
+}
+
+ScriptRecorder::~ScriptRecorder()
+{
+	finish();
+}
+
+void
+ScriptRecorder::recordEvent(QObject *object, QEvent *event, EventRecord *rec)
+{
+	if (mFinished) {
+		delete rec;
+		return;
+	}
+
+	switch (event->type()) {
+	case QEvent::ApplicationActivate:
+		// Only the first one matters; the others are us switching windows
+		if (mActivated)
+			break;
+		mActivated = true;
+		writeAction(rec, "wait-event");
+		return;
+
+	case QEvent::MouseButtonPress:
+	case QEvent::MouseButtonRelease:
+	case QEvent::MouseButtonDblClick:
+		flushText();
+		recordMouse(event, rec);
+		return;
+
+	case QEvent::KeyPress:
+	case QEvent::KeyRelease:
+		flushPress();
+		recordKey(event, rec);
+		return;
+
+	case QEvent::Show:
+		// Wait for new windows before doing anything with them
+		if (!object->isWidgetType() || !((QWidget *) object)->isWindow())
+			break;
+
+		flushText();
+		if (mPress)
+			mDeferred.append(rec);
+		else
+			writeAction(rec, "wait-event");
+		return;
+
+	default: ;
+	}
+
+	delete rec;
+}
+
+void
+ScriptRecorder::recordMouse(QEvent *event, EventRecord *rec)
+{
+	if (event->type() != QEvent::MouseButtonRelease) {
+		flushPress();
+
+		// Playing back two clicks gives us the double click
+		if (event->type() == QEvent::MouseButtonDblClick) {
+			rec->removeAttribute("type");
+			rec->addAttribute("type", "MouseButtonPress");
+		}
+
+		mPress = rec;
+		return;
+	}
+
+	if (mPress
+	 && mPress->attribute("objectPath") == rec->attribute("objectPath")
+	 && mPress->attribute("button") == rec->attribute("button")) {
+		EventRecord *click = mPress;
+
+		mPress = 0;
+
+		click->removeAttribute("type");
+		click->removeAttribute("buttonState");
+		click->removeAttribute("globalX");
+		click->removeAttribute("globalY");
+
+		// Menu items are found by name, which is better than any position
+		if (click->targetHints()) {
+			click->removeAttribute("x");
+			click->removeAttribute("y");
+		}
+
+		writeAction(click, "click");
+		delete rec;
+
+		flushDeferred();
+		return;
+	}
+
+	flushPress();
+	writeAction(rec, "send-event");
+}
+
+void
+ScriptRecorder::recordKey(QEvent *event, EventRecord *rec)
+{
+	QKeyEvent *ev = (QKeyEvent *) event;
+	QString text = ev->text();
+	QString key = rec->attribute("key");
+	bool typing;
+
+	typing = !text.isEmpty() && text[0] >= ' ' && text[0] != QChar(0x7f)
+	      && !(ev->modifiers() & ~(Qt::ShiftModifier | Qt::KeypadModifier));
+
+	if (event->type() == QEvent::KeyPress) {
+		if (!typing) {
+			flushText();
+			writeAction(rec, "send-event");
+			return;
+		}
+
+		if (mTextFirst && rec->attribute("objectPath") != mTextFirst->attribute("objectPath"))
+			flushText();
+
+		mText += text;
+		mTextKeys.append(key);
+		if (mTextFirst == 0)
+			mTextFirst = rec;
+		else
+			delete rec;
+		return;
+	}
+
+	// Releases of typed keys may come in late, after we've moved on
+	if (mTextKeys.removeOne(key)) {
+		delete rec;
+		return;
+	}
+
+	writeAction(rec, "send-event");
+}
+
+void
+ScriptRecorder::flushPress()
+{
+	if (mPress) {
+		writeAction(mPress, "send-event");
+		mPress = 0;
+	}
+	flushDeferred();
+}
+
+void
+ScriptRecorder::flushText()
+{
+	EventRecord *rec = mTextFirst;
+	Attribute::list attributes;
+
+	if (rec == 0)
+		return;
+
+	// Keep the object path, and the class hints an unnamed receiver needs
+	attributes = rec->attributes();
+	for (int i = 0; i < attributes.count(); ++i) {
+		if (attributes[i].name != "objectPath")
+			rec->removeAttribute(attributes[i].name);
+	}
+	rec->addAttribute("text", mText);
+	writeAction(rec, "type-text");
+
+	mTextFirst = 0;
+	mText = QString();
+}
+
+void
+ScriptRecorder::flushDeferred()
+{
+	while (!mDeferred.isEmpty())
+		writeAction(mDeferred.takeFirst(), "wait-event");
+}
+
+/*
+ * Turn an event record into a script action and write it
+ */
+void
+ScriptRecorder::writeAction(EventRecord *rec, const QString &name)
+{
+	rec->setName(name);
+	rec->removeAttribute("timestamp");
+	rec->RecordNode::write(mFile);
+	delete rec;
+}
+
+void
+ScriptRecorder::finish()
+{
+	if (mFinished)
+		return;
+
+	flushText();
+	flushPress();
+
+	fprintf(mFile, "<wait-application-exit/>\n");
+	fprintf(mFile, "</script>\n");
+	fflush(mFile);
+
+	mFinished = true;
+}
@@ -0,0 +1,59 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Recording of playable scripts
+//
+//	Rather than logging every event, this turns what the user
+//	does into script actions: a mouse press and release on the
+//	same widget become a <click>, consecutive keys typed into
+//	the same widget become a <type-text>, and windows showing
+//	up become <wait-event> synchronization points. Focus
+//	changes, which follow from all of the above, are dropped.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_SCRIPTRECORDER_H
+#define PUPPETEER_SCRIPTRECORDER_H
+
+#include <qstring.h>
+#include <qstringlist.h>
+#include <stdio.h>
+
+#include "puppeteer.h"
+
+class ScriptRecorder {
+public:
+	ScriptRecorder(FILE *fp = stdout);
+	~ScriptRecorder();
+
+	// Takes ownership of the record
+	void			recordEvent(QObject *, QEvent *, EventRecord *);
+
+	void			finish();
+
+private:
+	void			recordMouse(QEvent *, EventRecord *);
+	void			recordKey(QEvent *, EventRecord *);
+
+	void			flushPress();
+	void			flushText();
+	void			flushDeferred();
+
+	void			writeAction(EventRecord *, const QString &name);
+
+	FILE *			mFile;
+	bool			mFinished;
+	bool			mActivated;
+
+	// A mouse press waiting for its release
+	EventRecord *		mPress;
+
+	// Text typed so far, and the keys whose release we still expect
+	EventRecord *		mTextFirst;	// the first key typed, for where it went
+	QString			mText;
+	QStringList		mTextKeys;
+
+	// Things that happened while a press was pending
+	QList<EventRecord *>	mDeferred;
+};
+
+#endif /* PUPPETEER_SCRIPTRECORDER_H */
@@ -0,0 +1,455 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Snapshots of the widget tree
+//
+//	The tracker watches the event stream for anything that may
+//	change the state of a widget, and marks that widget (and its
+//	ancestors) dirty. When capturing, clean subtrees are taken
+//	verbatim from the previous capture, unless they are hidden.
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qapplication.h>
+#include <qevent.h>
+#include <qmetaobject.h>
+#include <qdom.h>
+#include <qfile.h>
+#include <qvector.h>
+#include <qalgorithms.h>
+
+#include <stdio.h>
+#include <string.h>
+#include "snapshot.h"
+
+
+// Properties we record for every widget that has them
+static const char *	snapshotProperties[] = {
+	"text",
+	"title",
+	"windowTitle",
+	"checked",
+	"currentIndex",
+	"value",
+
+	NULL
+};
+
+static inline quint64
+hashMix(quint64 h, quint64 v)
+{
+	return (h ^ v) * 1099511628211ULL;
+}
+
+QString
+SnapshotNode::key() const
+{
+	return className + "/" + objectName;
+}
+
+void
+SnapshotNode::updateHash()
+{
+	quint64 h = 14695981039346656037ULL;
+
+	h = hashMix(h, qHash(objectName));
+	h = hashMix(h, qHash(className));
+	h = hashMix(h, geometry.x());
+	h = hashMix(h, geometry.y());
+	h = hashMix(h, geometry.width());
+	h = hashMix(h, geometry.height());
+	h = hashMix(h, (visible? 1 : 0) | (enabled? 2 : 0));
+
+	for (Attribute::list::const_iterator it = properties.begin(); it != properties.end(); ++it) {
+		h = hashMix(h, qHash(it->name));
+		h = hashMix(h, qHash(it->value));
+	}
+
+	hidden = !visible;
+	for (list::const_iterator it = children.begin(); it != children.end(); ++it) {
+		h = hashMix(h, (*it)->hash);
+		hidden = hidden || (*it)->hidden;
+	}
+
+	hash = h;
+}
+
+static bool
+snapshotNodeLessThan(const SnapshotNode::Ptr &a, const SnapshotNode::Ptr &b)
+{
+	return a->key() < b->key();
+}
+
+/*
+ * Conversion between snapshot nodes and their XML representation
+ */
+static RecordNode *
+snapshotToRecord(const SnapshotNode *node, RecordNode *parent)
+{
+	RecordNode *rec = parent->addChild("widget");
+
+	if (!node->objectName.isEmpty())
+		rec->addAttribute("name", node->objectName);
+	rec->addAttribute("class", node->className);
+	rec->addAttribute("x", QString::number(node->geometry.x()));
+	rec->addAttribute("y", QString::number(node->geometry.y()));
+	rec->addAttribute("width", QString::number(node->geometry.width()));
+	rec->addAttribute("height", QString::number(node->geometry.height()));
+	rec->addAttribute("visible", node->visible? "true" : "false");
+	rec->addAttribute("enabled", node->enabled? "true" : "false");
+
+	for (Attribute::list::const_iterator it = node->properties.begin(); it != node->properties.end(); ++it) {
+		RecordNode *prop = rec->addChild("property");
+
+		prop->addAttribute("name", it->name);
+		prop->addAttribute("value", it->value);
+	}
+
+	for (SnapshotNode::list::const_iterator it = node->children.begin(); it != node->children.end(); ++it)
+		snapshotToRecord(it->data(), rec);
+
+	return rec;
+}
+
+static SnapshotNode::Ptr
+snapshotFromRecord(const RecordNode *rec)
+{
+	SnapshotNode::Ptr node(new SnapshotNode);
+
+	node->objectName = rec->attribute("name");
+	node->className = rec->attribute("class");
+	node->geometry = QRect(rec->attribute("x").toInt(),
+				rec->attribute("y").toInt(),
+				rec->attribute("width").toInt(),
+				rec->attribute("height").toInt());
+	node->visible = (rec->attribute("visible") == "true");
+	node->enabled = (rec->attribute("enabled") == "true");
+
+	const RecordNode::list &children(rec->children());
+	for (RecordNode::list::const_iterator it = children.begin(); it != children.end(); ++it) {
+		const RecordNode *child = *it;
+
+		if (child->name() == "property")
+			node->properties.append(Attribute(child->attribute("name"), child->attribute("value")));
+		else
+		if (child->name() == "widget")
+			node->children.append(snapshotFromRecord(child));
+	}
+
+	node->updateHash();
+	return node;
+}
+
+bool
+Snapshot::load(const QString &filename)
+{
+	QDomDocument doc("snapshot");
+	QFile file(filename);
+
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	if (!doc.setContent(&file)) {
+		file.close();
+		return false;
+	}
+	file.close();
+
+	RecordNode rec(doc.documentElement());
+	mRoot = snapshotFromRecord(&rec);
+	return true;
+}
+
+bool
+Snapshot::write(FILE *fp) const
+{
+	RecordNode rec("snapshot");
+
+	if (!mRoot)
+		return false;
+
+	for (SnapshotNode::list::const_iterator it = mRoot->children.begin(); it != mRoot->children.end(); ++it)
+		snapshotToRecord(it->data(), &rec);
+
+	return rec.write(fp);
+}
+
+bool
+Snapshot::save(const QString &filename) const
+{
+	FILE *fp;
+
+	if (!mRoot)
+		return false;
+
+	if ((fp = fopen(qPrintable(filename), "w")) == NULL) {
+		perror(qPrintable(filename));
+		return false;
+	}
+
+	write(fp);
+	return fclose(fp) == 0;
+}
+
+/*
+ * Compare two snapshots.
+ * Shared subtrees (or subtrees with identical hashes) are skipped without
+ * looking at them, so the cost is proportional to the number of nodes
+ * that actually changed, plus their ancestors.
+ */
+static QString
+snapshotPath(const QString &parentPath, const SnapshotNode *node)
+{
+	QString name;
+
+	if (node->objectName.isEmpty())
+		name = QString("[%1]").arg(node->className);
+	else
+		name = node->objectName;
+
+	if (parentPath.isEmpty())
+		return name;
+	return parentPath + "." + name;
+}
+
+static void
+diffNodes(const SnapshotNode *a, const SnapshotNode *b, const QString &path, QStringList &changes, bool compareGeometry)
+{
+	if (a == b || a->hash == b->hash)
+		return;
+
+	if (compareGeometry && a->geometry != b->geometry) {
+		changes.append(QString("%1: geometry %2x%3+%4+%5 -> %6x%7+%8+%9")
+				.arg(path)
+				.arg(a->geometry.width()).arg(a->geometry.height())
+				.arg(a->geometry.x()).arg(a->geometry.y())
+				.arg(b->geometry.width()).arg(b->geometry.height())
+				.arg(b->geometry.x()).arg(b->geometry.y()));
+	}
+	if (a->visible != b->visible)
+		changes.append(QString("%1: %2").arg(path, b->visible? "shown" : "hidden"));
+	if (a->enabled != b->enabled)
+		changes.append(QString("%1: %2").arg(path, b->enabled? "enabled" : "disabled"));
+
+	for (Attribute::list::const_iterator it = a->properties.begin(); it != a->properties.end(); ++it) {
+		Attribute::list::const_iterator jt;
+
+		for (jt = b->properties.begin(); jt != b->properties.end(); ++jt) {
+			if (jt->name == it->name)
+				break;
+		}
+
+		if (jt == b->properties.end())
+			changes.append(QString("%1: property %2 disappeared").arg(path, it->name));
+		else
+		if (jt->value != it->value)
+			changes.append(QString("%1: property %2 \"%3\" -> \"%4\"").arg(path, it->name, it->value, jt->value));
+	}
+	for (Attribute::list::const_iterator jt = b->properties.begin(); jt != b->properties.end(); ++jt) {
+		Attribute::list::const_iterator it;
+
+		for (it = a->properties.begin(); it != a->properties.end(); ++it) {
+			if (it->name == jt->name)
+				break;
+		}
+		if (it == a->properties.end())
+			changes.append(QString("%1: new property %2=\"%3\"").arg(path, jt->name, jt->value));
+	}
+
+	const SnapshotNode::list &ac(a->children), &bc(b->children);
+	int i, j;
+
+	// Common case: same children in the same order
+	if (ac.count() == bc.count()) {
+		for (i = 0; i < ac.count(); ++i) {
+			if (ac[i]->key() != bc[i]->key())
+				break;
+		}
+
+		if (i == ac.count()) {
+			for (i = 0; i < ac.count(); ++i) {
+				if (ac[i]->hash != bc[i]->hash)
+					diffNodes(ac[i].data(), bc[i].data(), snapshotPath(path, bc[i].data()), changes, compareGeometry);
+			}
+			return;
+		}
+	}
+
+	// Children were added or removed; match them up by class and name
+	QVector<bool> used(bc.count(), false);
+	for (i = 0; i < ac.count(); ++i) {
+		QString key = ac[i]->key();
+
+		for (j = 0; j < bc.count(); ++j) {
+			if (!used[j] && bc[j]->key() == key)
+				break;
+		}
+
+		if (j < bc.count()) {
+			used[j] = true;
+			diffNodes(ac[i].data(), bc[j].data(), snapshotPath(path, bc[j].data()), changes, compareGeometry);
+		} else {
+			changes.append(QString("%1: removed").arg(snapshotPath(path, ac[i].data())));
+		}
+	}
+	for (j = 0; j < bc.count(); ++j) {
+		if (!used[j])
+			changes.append(QString("%1: added").arg(snapshotPath(path, bc[j].data())));
+	}
+}
+
+unsigned int
+Snapshot::diff(const Snapshot &other, QStringList &changes, bool compareGeometry) const
+{
+	int count = changes.count();
+
+	if (!mRoot || !other.mRoot)
+		return 0;
+
+	diffNodes(mRoot.data(), other.mRoot.data(), QString(), changes, compareGeometry);
+	return changes.count() - count;
+}
+
+/*
+ * Dirty tracking
+ */
+void
+SnapshotTracker::observeEvent(QObject *object, QEvent *event)
+{
+	if (!object->isWidgetType())
+		return;
+
+	switch (event->type()) {
+	case QEvent::ChildAdded:
+	case QEvent::ChildRemoved:
+		{
+			QObject *child = ((QChildEvent *) event)->child();
+
+			mCache.remove(child);
+			mDirty.remove(child);
+		}
+		/* fallthru */
+
+	case QEvent::Move:
+	case QEvent::Resize:
+	case QEvent::Show:
+	case QEvent::Hide:
+	case QEvent::ShowToParent:
+	case QEvent::HideToParent:
+	case QEvent::ZOrderChange:
+	case QEvent::Paint:
+	case QEvent::EnabledChange:
+	case QEvent::FontChange:
+	case QEvent::StyleChange:
+	case QEvent::WindowTitleChange:
+	case QEvent::ParentChange:
+	case QEvent::DynamicPropertyChange:
+	case QEvent::LanguageChange:
+		markDirty((QWidget *) object);
+		break;
+
+	default: ;
+	}
+}
+
+void
+SnapshotTracker::markDirty(QWidget *w)
+{
+	// The ancestors of a dirty widget are always dirty, so we
+	// can stop as soon as we hit one that has been marked already
+	for (; w != 0; w = w->parentWidget()) {
+		if (mDirty.contains(w))
+			break;
+		mDirty.insert(w);
+	}
+}
+
+Snapshot
+SnapshotTracker::capture(QWidget *root)
+{
+	SnapshotNode::Ptr top(new SnapshotNode);
+
+	if (root) {
+		top->children.append(captureWidget(root));
+	} else {
+		QWidgetList toplevels = qApp->topLevelWidgets();
+
+		for (QWidgetList::const_iterator it = toplevels.begin(); it != toplevels.end(); ++it) {
+			QWidget *w = *it;
+
+			// Parented popups are captured along with their parent
+			if (w->parentWidget() == 0 && w->isVisible())
+				top->children.append(captureWidget(w));
+		}
+
+		// topLevelWidgets() comes in no particular order
+		qSort(top->children.begin(), top->children.end(), snapshotNodeLessThan);
+	}
+
+	top->updateHash();
+	return Snapshot(top);
+}
+
+SnapshotNode::Ptr
+SnapshotTracker::captureWidget(QWidget *w)
+{
+	QHash<QObject *, CacheEntry>::const_iterator cached = mCache.find(w);
+	SnapshotNode::Ptr previous;
+
+	// The guard catches widgets that were deleted and whose
+	// address got recycled
+	if (cached != mCache.end() && cached->widget == w) {
+		// Hidden widgets aren't painted, so nothing tells us when
+		// the text of a hidden label changes; look at any subtree
+		// that has them again
+		if (!mDirty.contains(w) && !cached->node->hidden)
+			return cached->node;
+		previous = cached->node;
+	}
+
+	SnapshotNode::Ptr node(new SnapshotNode);
+	const QMetaObject *metaObj = w->metaObject();
+
+	node->objectName = w->objectName();
+	node->className = metaObj->className();
+	node->geometry = w->geometry();
+	node->visible = w->isVisible();
+	node->enabled = w->isEnabled();
+
+	for (const char **name = snapshotProperties; *name; ++name) {
+		int index;
+
+		if (!strcmp(*name, "windowTitle") && !w->isWindow())
+			continue;
+
+		if ((index = metaObj->indexOfProperty(*name)) < 0)
+			continue;
+
+		QVariant data(metaObj->property(index).read(w));
+		if (data.isValid())
+			node->properties.append(Attribute(*name, data.toString()));
+	}
+
+	const QObjectList &children(w->children());
+	for (QObjectList::const_iterator it = children.begin(); it != children.end(); ++it) {
+		QWidget *child = qobject_cast<QWidget *>(*it);
+
+		if (child)
+			node->children.append(captureWidget(child));
+	}
+
+	node->updateHash();
+
+	// Widgets get marked dirty on every repaint; if nothing changed
+	// after all, keep sharing the node from the previous capture.
+	if (previous && previous->hash == node->hash) {
+		node = previous;
+	} else {
+		CacheEntry &entry(mCache[w]);
+
+		entry.widget = w;
+		entry.node = node;
+	}
+
+	mDirty.remove(w);
+	return node;
+}
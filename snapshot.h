@@ -0,0 +1,97 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Snapshots of the widget tree
+//
+//	A snapshot captures structure, names, classes, geometry
+//	and a handful of interesting properties of all widgets.
+//	Consecutive snapshots share all subtrees that did not
+//	change in between, so capturing and diffing them is
+//	proportional to what changed rather than to the size
+//	of the UI.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_SNAPSHOT_H
+#define PUPPETEER_SNAPSHOT_H
+
+#include <qshareddata.h>
+#include <qpointer.h>
+#include <qwidget.h>
+#include <qstringlist.h>
+#include <qhash.h>
+#include <qset.h>
+#include <qrect.h>
+
+#include "puppeteer.h"
+
+class SnapshotNode : public QSharedData {
+public:
+	typedef QExplicitlySharedDataPointer<SnapshotNode> Ptr;
+	typedef QList<Ptr> list;
+
+	SnapshotNode()
+	: visible(false), enabled(false), hidden(false), hash(0) {}
+
+	QString			key() const;
+	void			updateHash();
+
+	QString			objectName;
+	QString			className;
+	QRect			geometry;
+	bool			visible, enabled;
+	Attribute::list		properties;
+	list			children;
+
+	// This node or one of its descendants is hidden
+	bool			hidden;
+
+	// Covers this node and all its descendants
+	quint64			hash;
+};
+
+class Snapshot {
+public:
+	Snapshot() { }
+	Snapshot(const SnapshotNode::Ptr &root)
+	: mRoot(root) { }
+
+	bool			isNull() const { return !mRoot; }
+	const SnapshotNode::Ptr &root() const { return mRoot; }
+
+	bool			load(const QString &filename);
+	bool			save(const QString &filename) const;
+	bool			write(FILE *fp) const;
+
+	unsigned int		diff(const Snapshot &other, QStringList &changes, bool compareGeometry = true) const;
+
+private:
+	SnapshotNode::Ptr	mRoot;
+};
+
+class SnapshotTracker {
+public:
+	SnapshotTracker() { }
+
+	// Called from the event filter; marks widgets whose state may have changed
+	void			observeEvent(QObject *, QEvent *);
+
+	// Passing a NULL root captures all top-level widgets
+	Snapshot		capture(QWidget *root = 0);
+
+	Snapshot &		lastStep() { return mLastStep; }
+
+private:
+	SnapshotNode::Ptr	captureWidget(QWidget *);
+	void			markDirty(QWidget *);
+
+	struct CacheEntry {
+		QPointer<QWidget>	widget;
+		SnapshotNode::Ptr	node;
+	};
+
+	QHash<QObject *, CacheEntry> mCache;
+	QSet<QObject *>		mDirty;
+	Snapshot		mLastStep;
+};
+
+#endif /* PUPPETEER_SNAPSHOT_H */
@@ -0,0 +1,207 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Stack traces of the GUI thread
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qstring.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <execinfo.h>
+#include <ucontext.h>
+#include <cxxabi.h>
+#include "stack.h"
+
+enum { MaxFrames = 64 };
+
+static pthread_t	theMainThread;
+static int		theSignal;
+static sem_t		theCaptureDone;
+
+// Filled in by the signal handler
+static void *		theFrames[MaxFrames];
+static volatile int	theFrameCount;
+
+int
+stackCaptureSelf(void **frames, int max, int skip)
+{
+	void *buffer[MaxFrames];
+	int count;
+
+	count = backtrace(buffer, MaxFrames);
+	if (skip > count)
+		skip = count;
+	count -= skip;
+	if (count > max)
+		count = max;
+	memcpy(frames, buffer + skip, count * sizeof(void *));
+	return count;
+}
+
+/*
+ * Where the signal hit. The unwinder reports this very address for
+ * the frame below the signal trampoline, rather than a return address.
+ */
+static void *
+interruptedPc(const void *context)
+{
+	const ucontext_t *uc = (const ucontext_t *) context;
+
+#if defined(__x86_64__)
+	return (void *) uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+	return (void *) uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+	return (void *) uc->uc_mcontext.pc;
+#else
+	return 0;
+#endif
+}
+
+int
+stackCaptureInterrupted(void **frames, int max, const void *context, int skip)
+{
+	void *buffer[MaxFrames];
+	void *pc = interruptedPc(context);
+	int count, i;
+
+	count = backtrace(buffer, MaxFrames);
+
+	// Inlining decides how many frames the handler takes up
+	for (i = 0; pc && i < count; ++i) {
+		if (buffer[i] == pc) {
+			skip = i;
+			break;
+		}
+	}
+
+	if (skip > count)
+		skip = count;
+	count -= skip;
+	if (count > max)
+		count = max;
+	memcpy(frames, buffer + skip, count * sizeof(void *));
+	return count;
+}
+
+static void
+stackCaptureSignal(int sig, siginfo_t *, void *context)
+{
+	int saved = errno;
+
+	// Leave out ourselves and the signal trampoline
+	theFrameCount = stackCaptureInterrupted(theFrames, MaxFrames, context, 3);
+	sem_post(&theCaptureDone);
+	errno = saved;
+}
+
+bool
+stackCaptureInit()
+{
+	struct sigaction sa;
+	void *dummy[4];
+
+	if (theSignal)
+		return true;
+
+	// The first backtrace() loads libgcc, which must not happen in a signal handler
+	backtrace(dummy, 4);
+
+	theMainThread = pthread_self();
+	theSignal = SIGRTMIN + 3;
+	if (sem_init(&theCaptureDone, 0, 0) < 0) {
+		perror("sem_init");
+		theSignal = 0;
+		return false;
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = stackCaptureSignal;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART | SA_SIGINFO;
+	sigaction(theSignal, &sa, NULL);
+	return true;
+}
+
+int
+stackCaptureMain(void **frames, int max, unsigned int timeoutMsec)
+{
+	struct timespec deadline;
+
+	if (!theSignal)
+		return 0;
+
+	// A late answer to an earlier request must not count for this one
+	while (sem_trywait(&theCaptureDone) == 0)
+		;
+
+	theFrameCount = 0;
+	if (pthread_kill(theMainThread, theSignal) != 0)
+		return 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeoutMsec / 1000;
+	deadline.tv_nsec += (timeoutMsec % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	while (sem_timedwait(&theCaptureDone, &deadline) < 0) {
+		if (errno != EINTR)
+			return 0;
+	}
+
+	if (max > theFrameCount)
+		max = theFrameCount;
+	memcpy(frames, theFrames, max * sizeof(void *));
+	return max;
+}
+
+/*
+ * backtrace_symbols() gives us "library(mangled+0x1f) [0x4005d2]"
+ */
+QStringList
+stackSymbolize(void * const *frames, int count)
+{
+	QStringList result;
+	char **symbols;
+
+	if (count <= 0 || (symbols = backtrace_symbols(frames, count)) == NULL)
+		return result;
+
+	for (int i = 0; i < count; ++i) {
+		QString line = symbols[i];
+		QString library, function;
+		char *demangled;
+		int open, plus, status;
+
+		open = line.indexOf('(');
+		plus = line.indexOf('+', open);
+		if (open < 0 || plus < 0 || plus == open + 1) {
+			result.append(line);
+			continue;
+		}
+
+		library = line.left(open);
+		function = line.mid(open + 1, plus - open - 1);
+
+		demangled = abi::__cxa_demangle(qPrintable(function), NULL, NULL, &status);
+		if (demangled) {
+			function = demangled;
+			free(demangled);
+		}
+
+		result.append(function + " (" + library.section('/', -1) + ")");
+	}
+
+	free(symbols);
+	return result;
+}
@@ -0,0 +1,39 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Stack traces of the GUI thread
+//
+//	Another thread cannot walk the stack of the GUI thread, so
+//	we send the GUI thread a signal and have it take the trace
+//	itself, in the signal handler. That works even while it is
+//	stuck in a system call or a long computation, which is
+//	exactly when we want to know where it is.
+//
+//	Addresses are turned into function names afterwards, by
+//	the thread that asked for the trace.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_STACK_H
+#define PUPPETEER_STACK_H
+
+#include <qstringlist.h>
+
+// Call from the GUI thread, before anything else below
+extern bool		stackCaptureInit();
+
+// Returns the number of frames stored, 0 if the GUI thread didn't respond in time
+extern int		stackCaptureMain(void **frames, int max, unsigned int timeoutMsec);
+
+// Trace of the calling thread; safe to call from a signal handler once
+// stackCaptureInit() is done. Skips the given number of innermost frames.
+extern int		stackCaptureSelf(void **frames, int max, int skip);
+
+// The same, from a signal handler installed with SA_SIGINFO, starting
+// at the frame the signal interrupted. If that frame cannot be found,
+// the given number of innermost frames is skipped instead.
+extern int		stackCaptureInterrupted(void **frames, int max, const void *ucontext, int skip);
+
+// "function (library)" for each frame; C++ names are demangled
+extern QStringList	stackSymbolize(void * const *frames, int count);
+
+#endif /* PUPPETEER_STACK_H */
@@ -0,0 +1,621 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Tests written in C++
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qapplication.h>
+#include <qmetaobject.h>
+#include <qmap.h>
+#include <qlist.h>
+#include <qstringlist.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include "testcase.h"
+#include "puppeteer.h"
+#include "pathtable.h"
+#include "flightrecorder.h"
+#include "namespace.h"
+
+#ifdef __cpp_impl_coroutine
+
+/*
+ * The test that is being run
+ */
+class TestRun {
+public:
+	TestRun(const QString &n, TestCase::Coroutine::Handle h)
+	: name(n), handle(h), waiting(0), status(Puppeteer::ExitPass),
+	  started(false), running(false), resuming(false) {}
+
+	QString			name;
+	TestCase::Coroutine::Handle handle;
+	QList<TestCase::Wait *>	armed;		// created, and not destroyed yet
+	TestCase::Wait *	waiting;	// the one the test awaits
+	Puppeteer::ExitStatus	status;
+	bool			started;
+	bool			running;	// between resume() and its return
+	bool			resuming;	// testResumeSlot() is on its way
+};
+
+typedef QMap<QString, TestCase::Function> TestMap;
+
+// A pointer, as tests register before our constructors may have run
+static TestMap *	theTests;
+static TestRun *	theRun;
+static bool		theSync = true;
+
+TestCase::Registration::Registration(const char *name, TestCase::Function function)
+{
+	if (theTests == 0)
+		theTests = new TestMap;
+	theTests->insert(name, function);
+}
+
+void
+TestCase::Coroutine::promise_type::unhandled_exception()
+{
+	fail("test threw an exception");
+}
+
+TestCase::Wait::Wait(Kind kind, QEvent::Type type, QObject *object, const QString &path,
+			const char *name, const QString &value, unsigned long timeout)
+: mKind(kind), mType(type), mObject(object), mPath(path), mName(name), mIndex(-1),
+  mValue(value), mTimeout(timeout), mHappened(false), mResult(0)
+{
+	if (theRun == 0)
+		return;
+	theRun->armed.append(this);
+
+	if (mKind == Signal) {
+		if (object)
+			mIndex = object->metaObject()->indexOfSignal(QMetaObject::normalizedSignature(name + 1));
+		if (mIndex < 0 || !QObject::connect(object, name, Puppeteer::instance(), SLOT(testSignalSlot()))) {
+			fail(QString("cannot wait for signal %1").arg(name + 1));
+			mIndex = -1;
+		}
+	} else
+	if (mKind == Property && checkProperty()) {
+		happened(mObject);
+	}
+}
+
+TestCase::Wait::~Wait()
+{
+	if (mIndex >= 0 && !mObject.isNull())
+		QObject::disconnect(mObject, mName.constData(), Puppeteer::instance(), SLOT(testSignalSlot()));
+
+	if (theRun == 0)
+		return;
+	theRun->armed.removeAll(this);
+	if (theRun->waiting == this)
+		theRun->waiting = 0;
+}
+
+/*
+ * Don't suspend if it already happened - unless the test failed,
+ * which ends it here
+ */
+bool
+TestCase::Wait::await_ready()
+{
+	if (!mHappened && mKind == Property && checkProperty())
+		happened(mObject);
+
+	return mHappened && theRun && theRun->status == Puppeteer::ExitPass;
+}
+
+void
+TestCase::Wait::await_suspend(std::coroutine_handle<>)
+{
+	Puppeteer *self = Puppeteer::instance();
+
+	if (theRun == 0)
+		return;
+
+	theRun->waiting = this;
+	if (mHappened || theRun->status != Puppeteer::ExitPass) {
+		self->testResume();
+		return;
+	}
+
+	printf("=== Test waiting for %s\n", qPrintable(describe()));
+	if (mKind == Idle)
+		QTimer::singleShot(0, self, SLOT(testIdleSlot()));
+	else
+		self->mTestTimer.start(mTimeout);
+}
+
+bool
+TestCase::Wait::checkProperty()
+{
+	QString value;
+
+	if (mObject.isNull() && !mPath.isEmpty())
+		mObject = find(mPath);
+	if (mObject.isNull())
+		return false;
+
+	return Puppeteer::instance()->getObjectProperty(mObject, mName.constData(), value) && value == mValue;
+}
+
+void
+TestCase::Wait::happened(QObject *object)
+{
+	if (mHappened)
+		return;
+
+	mHappened = true;
+	mResult = object;
+	if (theRun && theRun->waiting == this)
+		Puppeteer::instance()->testResume();
+}
+
+QString
+TestCase::Wait::describe() const
+{
+	QString what = mObject.isNull()? mPath : QString(mObject->metaObject()->className());
+
+	switch (mKind) {
+	case Event:
+		return QString("%1 event for %2").arg(eventTypeName(mType)).arg(what);
+	case Signal:
+		return QString("signal %1").arg(mName.constData() + 1);
+	case Property:
+		return QString("property %1=\"%2\" of %3").arg(mName.constData()).arg(mValue).arg(what);
+	default:
+		return "the application to be idle";
+	}
+}
+
+TestCase::Wait
+TestCase::waitEvent(QEvent::Type type, const QString &objectPath, unsigned long msec)
+{
+	return Wait(Wait::Event, type, 0, objectPath, 0, QString(), msec);
+}
+
+TestCase::Wait
+TestCase::waitEvent(QEvent::Type type, QObject *receiver, unsigned long msec)
+{
+	return Wait(Wait::Event, type, receiver, QString(), 0, QString(), msec);
+}
+
+TestCase::Wait
+TestCase::waitSignal(QObject *sender, const char *signal, unsigned long msec)
+{
+	return Wait(Wait::Signal, QEvent::None, sender, QString(), signal, QString(), msec);
+}
+
+TestCase::Wait
+TestCase::waitProperty(const QString &objectPath, const char *name, const QString &value, unsigned long msec)
+{
+	return Wait(Wait::Property, QEvent::None, 0, objectPath, name, value, msec);
+}
+
+TestCase::Wait
+TestCase::waitProperty(QObject *object, const char *name, const QString &value, unsigned long msec)
+{
+	return Wait(Wait::Property, QEvent::None, object, QString(), name, value, msec);
+}
+
+TestCase::Wait
+TestCase::idle()
+{
+	return Wait(Wait::Idle, QEvent::None, 0, QString(), 0, QString(), 0);
+}
+
+QWidget *
+TestCase::find(const QString &objectPath)
+{
+	EventRecord rec("find");
+
+	rec.addAttribute("objectPath", objectPath);
+	return Puppeteer::instance()->objectForRecord(&rec);
+}
+
+QWidget *
+TestCase::widget(const QString &objectPath)
+{
+	QWidget *w;
+
+	if ((w = find(objectPath)) == 0)
+		fail(QString("object %1 not found").arg(objectPath));
+	return w;
+}
+
+void
+TestCase::setSync(bool sync)
+{
+	theSync = sync;
+}
+
+bool
+TestCase::click(const QString &objectPath, Qt::MouseButton button, Qt::KeyboardModifiers modifiers)
+{
+	return click(widget(objectPath), button, modifiers);
+}
+
+bool
+TestCase::click(QWidget *w, Qt::MouseButton button, Qt::KeyboardModifiers modifiers)
+{
+	Puppeteer *self = Puppeteer::instance();
+	QPoint pos;
+
+	// widget() failed the test already
+	if (w == 0)
+		return false;
+
+	pos = w->rect().center();
+	printf("=== Clicking %s at <%d,%d>\n", w->metaObject()->className(), pos.x(), pos.y());
+	if (!self->playbackDeliver(w, new QMouseEvent(QEvent::MouseButtonPress, pos, w->mapToGlobal(pos),
+					button, button, modifiers), theSync)) {
+		printf("=== Receiver was deleted on mouse press, not releasing\n");
+		return true;
+	}
+	self->playbackDeliver(w, new QMouseEvent(QEvent::MouseButtonRelease, pos, w->mapToGlobal(pos),
+				button, Qt::NoButton, modifiers), theSync);
+	return true;
+}
+
+bool
+TestCase::key(QWidget *w, int key, Qt::KeyboardModifiers modifiers)
+{
+	Puppeteer *self = Puppeteer::instance();
+
+	if (w == 0)
+		return false;
+
+	if (!self->playbackDeliver(w, new QKeyEvent(QEvent::KeyPress, key, modifiers), theSync)
+	 || !self->playbackDeliver(w, new QKeyEvent(QEvent::KeyRelease, key, modifiers), theSync)) {
+		fail("key event receiver was deleted");
+		return false;
+	}
+	return true;
+}
+
+bool
+TestCase::typeText(const QString &objectPath, const QString &text)
+{
+	return typeText(widget(objectPath), text);
+}
+
+bool
+TestCase::typeText(QWidget *w, const QString &text)
+{
+	if (w == 0)
+		return false;
+
+	if (!Puppeteer::instance()->playbackTypeText(w, text, false, theSync)) {
+		fail("cannot type text");
+		return false;
+	}
+	return true;
+}
+
+bool
+TestCase::setFocus(QWidget *w)
+{
+	if (w == 0)
+		return false;
+
+	w->setFocus(Qt::OtherFocusReason);
+	if (qApp->focusWidget() != w) {
+		fail(QString("unable to set focus to %1").arg(w->metaObject()->className()));
+		return false;
+	}
+	return true;
+}
+
+bool
+TestCase::verify(const QString &objectPath, const char *property, const QString &expected)
+{
+	return verify(widget(objectPath), property, expected);
+}
+
+bool
+TestCase::verify(QObject *object, const char *property, const QString &expected)
+{
+	QString actual;
+
+	if (object == 0)
+		return false;
+
+	if (!Puppeteer::instance()->getObjectProperty(object, property, actual)) {
+		fail(QString("object does not support property %1").arg(property));
+		return false;
+	}
+
+	if (actual != expected) {
+		fail(QString("object property %1 does not match. Expected \"%2\", got \"%3\"")
+				.arg(property).arg(expected).arg(actual));
+		return false;
+	}
+
+	printf("=== Verify ok: object property %s=\"%s\"\n", property, qPrintable(expected));
+	return true;
+}
+
+bool
+TestCase::verify(bool condition, const char *what)
+{
+	if (!condition)
+		fail(QString("%1 does not hold").arg(what));
+	return condition;
+}
+
+void
+TestCase::fail(const QString &why)
+{
+	printf("=== FAIL: %s\n", qPrintable(why));
+	if (theRun && theRun->status == Puppeteer::ExitPass)
+		theRun->status = Puppeteer::ExitFail;
+}
+
+/*
+ * PUPPETEER_TEST runs the tests named, or all of them, as a session.
+ * Tests may be linked into the application, or be in a library that
+ * PUPPETEER_TEST_LIBRARY names.
+ */
+void
+Puppeteer::testStart(const char *names)
+{
+	const char *value;
+	QStringList list;
+
+	if ((value = getenv("PUPPETEER_TEST_LIBRARY")) != NULL && dlopen(value, RTLD_NOW | RTLD_GLOBAL) == NULL)
+		fprintf(stderr, "=== Cannot load tests: %s\n", dlerror());
+
+	// Unknown names fail when their turn comes
+	if (!strcmp(names, "all")) {
+		if (theTests)
+			list = theTests->keys();
+	} else {
+		list = QString(names).split(':', QString::SkipEmptyParts);
+	}
+	if (list.isEmpty())
+		fprintf(stderr, "=== No tests to run\n");
+
+	mTesting = true;
+
+	if (mPaths == 0)
+		mPaths = new PathTable;
+
+	mTestTimer.setSingleShot(true);
+	connect(&mTestTimer, SIGNAL(timeout()), this, SLOT(testTimeoutSlot()));
+	mTestCheckTimer.setSingleShot(true);
+	connect(&mTestCheckTimer, SIGNAL(timeout()), this, SLOT(testCheckSlot()));
+
+	sessionStart(list);
+}
+
+void
+Puppeteer::testRun(const QString &name)
+{
+	TestCase::Function function;
+
+	if (theTests == 0 || (function = theTests->value(name)) == 0) {
+		fprintf(stderr, "=== No test named \"%s\"\n", qPrintable(name));
+		sessionScriptDone(ExitScriptError);
+		return;
+	}
+
+	theSync = true;
+	theRun = new TestRun(name, function().release());
+
+	mStep = 1;
+	if (mPerf)
+		perfReset();
+	if (mTrace)
+		traceScriptStart(name);
+
+	// Otherwise, when the application comes up
+	if (applicationActive)
+		testResume();
+}
+
+void
+Puppeteer::testObserveEvent(QObject *object, QEvent *event)
+{
+	if (theRun == 0)
+		return;
+
+	if (!theRun->started) {
+		if (applicationActive)
+			testResume();
+		return;
+	}
+
+	for (int i = 0; i < theRun->armed.count(); ++i) {
+		TestCase::Wait *wait = theRun->armed[i];
+
+		if (wait->mHappened)
+			continue;
+
+		switch (wait->mKind) {
+		case TestCase::Wait::Event:
+			if (event->type() != wait->mType)
+				break;
+			if (wait->mPath.isEmpty()? object == wait->mObject
+			                         : mPaths->path(internObjectPath(object)) == wait->mPath)
+				wait->happened(object);
+			break;
+
+		case TestCase::Wait::Property:
+			// Once the application is done with whatever it is doing
+			if (object != &mTestCheckTimer && !mTestCheckTimer.isActive())
+				mTestCheckTimer.start(0);
+			break;
+
+		default: ;
+		}
+	}
+}
+
+void
+Puppeteer::testCheckSlot()
+{
+	if (theRun == 0)
+		return;
+
+	for (int i = 0; i < theRun->armed.count(); ++i) {
+		TestCase::Wait *wait = theRun->armed[i];
+
+		if (wait->mKind == TestCase::Wait::Property && !wait->mHappened && wait->checkProperty())
+			wait->happened(wait->mObject);
+	}
+}
+
+void
+Puppeteer::testSignalSlot()
+{
+	QObject *object = sender();
+	int index = senderSignalIndex();
+
+	if (theRun == 0)
+		return;
+
+	for (int i = 0; i < theRun->armed.count(); ++i) {
+		TestCase::Wait *wait = theRun->armed[i];
+
+		if (wait->mKind == TestCase::Wait::Signal && wait->mObject == object && wait->mIndex == index)
+			wait->happened(object);
+	}
+}
+
+void
+Puppeteer::testIdleSlot()
+{
+	if (theRun && theRun->waiting && theRun->waiting->mKind == TestCase::Wait::Idle)
+		theRun->waiting->happened(0);
+}
+
+void
+Puppeteer::testTimeoutSlot()
+{
+	TestCase::Wait *wait;
+
+	if (theRun == 0 || (wait = theRun->waiting) == 0 || theRun->resuming)
+		return;
+
+	// Properties can change without an event that tells us
+	if (wait->mKind == TestCase::Wait::Property && wait->checkProperty()) {
+		wait->happened(wait->mObject);
+		return;
+	}
+
+	printf("=== Test timed out after %lu msec waiting for %s\n", wait->mTimeout, qPrintable(wait->describe()));
+	testFailed(ExitTimeout);
+}
+
+/*
+ * Never resume the test from where we are, which may be deep inside
+ * the delivery of an event
+ */
+void
+Puppeteer::testResume()
+{
+	if (theRun->resuming)
+		return;
+
+	theRun->resuming = true;
+	mTestTimer.stop();
+	QMetaObject::invokeMethod(this, "testResumeSlot", Qt::QueuedConnection);
+}
+
+void
+Puppeteer::testResumeSlot()
+{
+	if (theRun == 0 || !theRun->resuming || theRun->running)
+		return;
+
+	theRun->resuming = false;
+	theRun->started = true;
+	if (theRun->waiting) {
+		theRun->waiting = 0;
+		mStep++;
+	}
+
+	// A check failed; this is the first await since
+	if (theRun->status != ExitPass) {
+		testDone(theRun->status);
+		return;
+	}
+
+	// Runs until the test awaits something, or is done
+	theRun->running = true;
+	theRun->handle.resume();
+	theRun->running = false;
+
+	if (theRun->handle.done())
+		testDone(theRun->status);
+}
+
+/*
+ * A test that is running is ended when it awaits something
+ */
+void
+Puppeteer::testFailed(ExitStatus status)
+{
+	if (theRun == 0)
+		return;
+
+	if (theRun->status == ExitPass)
+		theRun->status = status;
+	if (!theRun->running)
+		testDone(theRun->status);
+}
+
+void
+Puppeteer::testDone(ExitStatus status)
+{
+	TestRun *run = theRun;
+
+	mTestTimer.stop();
+	mTestCheckTimer.stop();
+
+	if (status != ExitPass) {
+		printf("=== Test %s failed\n", qPrintable(run->name));
+		playbackDiagnostics();
+		if (mFlight && mFlight->dump())
+			printf("=== Flight recorder written to %s\n", mFlight->filename());
+	}
+
+	// This destroys whatever it was waiting for, too
+	run->handle.destroy();
+	theRun = 0;
+	delete run;
+
+	if (status != ExitPass && mFailurePolicy == FailureAbort) {
+		playbackTerminate(status);
+		return;
+	}
+
+	sessionScriptDone(status);
+}
+
+#else /* __cpp_impl_coroutine */
+
+void
+Puppeteer::testStart(const char *)
+{
+	fprintf(stderr, "=== This Puppeteer was built without C++20 coroutines, and cannot run C++ tests\n");
+	fflush(stdout);
+	_exit(ExitScriptError);
+}
+
+void Puppeteer::testRun(const QString &) {}
+void Puppeteer::testObserveEvent(QObject *, QEvent *) {}
+void Puppeteer::testResume() {}
+void Puppeteer::testFailed(ExitStatus) {}
+void Puppeteer::testDone(ExitStatus) {}
+void Puppeteer::testResumeSlot() {}
+void Puppeteer::testTimeoutSlot() {}
+void Puppeteer::testCheckSlot() {}
+void Puppeteer::testSignalSlot() {}
+void Puppeteer::testIdleSlot() {}
+
+#endif /* __cpp_impl_coroutine */
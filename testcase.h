@@ -0,0 +1,182 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Tests written in C++
+//
+//	Scripts are parsed, every attribute is a string, and each
+//	action waits for things to settle. For big suites, tests
+//	can be compiled into the application (or a library loaded
+//	with PUPPETEER_TEST_LIBRARY) instead:
+//
+//	PUPPETEER_TEST(terribleMorning)
+//	{
+//		QWidget *combo = widget("mainWindow.*.morningCombo");
+//
+//		setFocus(combo);
+//		key(combo, Qt::Key_Down);
+//		co_await waitProperty("mainWindow.*.helloLabel", "text",
+//				"Hello world. What a terrible morning.");
+//	}
+//
+//	A test is a C++20 coroutine that runs on the GUI thread.
+//	co_await suspends it and returns to the event loop; when
+//	what it waits for has happened, the test is resumed from
+//	a queued call, never from within the delivery of an event
+//	or a signal. There are no nested event loops and no sleeps.
+//
+//	A wait starts watching when it is created, so it can be
+//	set up before the action that causes what it waits for:
+//
+//		TestCase::Wait closed = waitSignal(dialog, SIGNAL(finished(int)));
+//		click(okButton);
+//		co_await closed;
+//
+//	Events are injected with QApplication::sendEvent(), so
+//	their effects are there when the call returns. A wait
+//	that times out ends the test; a check that fails makes
+//	it fail, and ends it the next time it awaits something.
+//
+//	Tests run like the scripts of a session, see
+//	Puppeteer::sessionStart(), once the application is
+//	active. PUPPETEER_TEST is a colon separated list of test
+//	names, or "all".
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_TESTCASE_H
+#define PUPPETEER_TESTCASE_H
+
+#include <qobject.h>
+#include <qevent.h>
+#include <qwidget.h>
+#include <qpointer.h>
+#include <qstring.h>
+#include <qbytearray.h>
+
+#ifdef __cpp_impl_coroutine
+
+#include <coroutine>
+
+class TestCase {
+public:
+	// What a test function returns
+	class Coroutine {
+	public:
+		struct promise_type {
+			Coroutine	get_return_object()
+					{
+						return Coroutine(std::coroutine_handle<promise_type>::from_promise(*this));
+					}
+			// Tests start running when their turn comes
+			std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+			// ... and are destroyed by whoever runs them
+			std::suspend_always final_suspend() noexcept { return std::suspend_always(); }
+			void		return_void() {}
+			void		unhandled_exception();
+		};
+		typedef std::coroutine_handle<promise_type> Handle;
+
+		Coroutine(Handle handle) : mHandle(handle) {}
+		Coroutine(Coroutine &&other) : mHandle(other.mHandle) { other.mHandle = Handle(); }
+		~Coroutine() { if (mHandle) mHandle.destroy(); }
+
+		Handle		release() { Handle handle = mHandle; mHandle = Handle(); return handle; }
+
+	private:
+		Coroutine(const Coroutine &);
+		Handle		mHandle;
+	};
+
+	typedef Coroutine	(*Function)();
+
+	// Something to co_await
+	class Wait {
+	public:
+		enum Kind { Event, Signal, Property, Idle };
+
+		Wait(Kind, QEvent::Type, QObject *object, const QString &path,
+			const char *name, const QString &value, unsigned long timeout);
+		~Wait();
+
+		bool		await_ready();
+		void		await_suspend(std::coroutine_handle<>);
+		// The receiver of the event, the sender of the signal, or the object with the property
+		QObject *	await_resume() const { return mResult; }
+
+	private:
+		friend class Puppeteer;
+
+		Wait(const Wait &);
+		bool		checkProperty();
+		void		happened(QObject *);
+		QString		describe() const;
+
+		Kind		mKind;
+		QEvent::Type	mType;
+		QPointer<QObject> mObject;	// 0 if given by path
+		QString		mPath;
+		QByteArray	mName;		// signal or property
+		int		mIndex;		// of the signal
+		QString		mValue;
+		unsigned long	mTimeout;	// msec
+		bool		mHappened;
+		QObject *	mResult;
+	};
+
+	// Adds itself to the list of tests at startup; see PUPPETEER_TEST below
+	class Registration {
+	public:
+		Registration(const char *name, Function);
+	};
+
+	enum { DefaultTimeout = 5000 };
+
+protected:
+	// Waits
+	static Wait		waitEvent(QEvent::Type, const QString &objectPath, unsigned long msec = DefaultTimeout);
+	static Wait		waitEvent(QEvent::Type, QObject *receiver, unsigned long msec = DefaultTimeout);
+	static Wait		waitSignal(QObject *sender, const char *signal, unsigned long msec = DefaultTimeout);
+	static Wait		waitProperty(const QString &objectPath, const char *name, const QString &value,
+					unsigned long msec = DefaultTimeout);
+	static Wait		waitProperty(QObject *, const char *name, const QString &value,
+					unsigned long msec = DefaultTimeout);
+	// Until the events that are queued up now have been handled
+	static Wait		idle();
+
+	// Finding objects; failing to is a failed check
+	static QWidget *	widget(const QString &objectPath);
+
+	// Injection. These return false, and fail the test, if they could not do their thing.
+	// Modal dialogs run an event loop of their own, so an action that opens one returns
+	// only once it is closed, unless events are posted rather than sent.
+	static void		setSync(bool);
+	static bool		click(const QString &objectPath, Qt::MouseButton = Qt::LeftButton,
+					Qt::KeyboardModifiers = Qt::NoModifier);
+	static bool		click(QWidget *, Qt::MouseButton = Qt::LeftButton,
+					Qt::KeyboardModifiers = Qt::NoModifier);
+	// For keys without text, such as cursor keys
+	static bool		key(QWidget *, int key, Qt::KeyboardModifiers = Qt::NoModifier);
+	static bool		typeText(const QString &objectPath, const QString &text);
+	static bool		typeText(QWidget *, const QString &text);
+	static bool		setFocus(QWidget *);
+
+	// Checks
+	static bool		verify(const QString &objectPath, const char *property, const QString &expected);
+	static bool		verify(QObject *, const char *property, const QString &expected);
+	static bool		verify(bool condition, const char *what);
+	static void		fail(const QString &why);
+
+private:
+	static QWidget *	find(const QString &objectPath);
+};
+
+#define PUPPETEER_TEST(name) \
+	class TestCase_##name : public TestCase { \
+	public: \
+		static TestCase::Coroutine run(); \
+	}; \
+	static TestCase::Registration theTestCase_##name(#name, TestCase_##name::run); \
+	TestCase::Coroutine TestCase_##name::run()
+
+#endif /* __cpp_impl_coroutine */
+
+#endif /* PUPPETEER_TESTCASE_H */
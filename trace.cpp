@@ -0,0 +1,370 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Timeline in the Chrome trace event format
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qapplication.h>
+#include <qfile.h>
+#include <qfileinfo.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "trace.h"
+#include "pathtable.h"
+#include "namespace.h"
+
+TraceWriter::TraceWriter()
+: mFile(0), mPid(getpid()), mCount(0), mNextTrack(FirstWindowTrack)
+{
+}
+
+TraceWriter::~TraceWriter()
+{
+	close();
+}
+
+bool
+TraceWriter::open(const QString &filename)
+{
+	if ((mFile = fopen(QFile::encodeName(filename), "w")) == NULL) {
+		perror(qPrintable(filename));
+		return false;
+	}
+	mFilename = filename;
+
+	fprintf(mFile, "[\n");
+
+	beginEvent('M', 0, 0, "process_name", 0);
+	fprintf(mFile, ",\"args\":{\"name\":");
+	writeString(QFileInfo(QCoreApplication::applicationFilePath()).fileName());
+	fprintf(mFile, "}}");
+
+	nameTrack(ScriptTrack, "script");
+	nameTrack(WatchdogTrack, "stalls");
+	nameTrack(ApplicationTrack, "application");
+	return true;
+}
+
+void
+TraceWriter::close()
+{
+	if (mFile == 0)
+		return;
+
+	fprintf(mFile, "\n]\n");
+	fclose(mFile);
+	mFile = 0;
+}
+
+/*
+ * Widgets go on the track of their window. Other objects go on the track
+ * of the widget they belong to, if any.
+ */
+int
+TraceWriter::track(QObject *object)
+{
+	QHash<QWidget *, Window>::iterator it;
+	QWidget *window;
+	Window entry;
+	QString name;
+
+	while (object && !object->isWidgetType())
+		object = object->parent();
+	if (object == 0)
+		return ApplicationTrack;
+
+	window = ((QWidget *) object)->window();
+
+	// A window that went away may have left its address to a new one
+	if ((it = mWindows.find(window)) != mWindows.end() && !it->widget.isNull())
+		return it->track;
+
+	// Forget the windows that are gone
+	for (it = mWindows.begin(); it != mWindows.end(); ) {
+		if (it->widget.isNull())
+			it = mWindows.erase(it);
+		else
+			++it;
+	}
+
+	if (window->objectName().isEmpty())
+		name = QString("%1 \"%2\"").arg(window->metaObject()->className()).arg(window->windowTitle());
+	else
+		name = QString("%1 \"%2\"").arg(window->objectName()).arg(window->windowTitle());
+
+	entry.widget = window;
+	if ((entry.track = mTracks.value(name)) == 0) {
+		entry.track = mNextTrack++;
+		mTracks.insert(name, entry.track);
+		nameTrack(entry.track, name);
+	}
+	mWindows.insert(window, entry);
+	return entry.track;
+}
+
+void
+TraceWriter::nameTrack(int track, const QString &name)
+{
+	if (mFile == 0)
+		return;
+
+	beginEvent('M', track, 0, "thread_name", 0);
+	fprintf(mFile, ",\"args\":{\"name\":");
+	writeString(name);
+	fprintf(mFile, "}}");
+
+	// Keep them in the order they appeared in
+	beginEvent('M', track, 0, "thread_sort_index", 0);
+	fprintf(mFile, ",\"args\":{\"sort_index\":%d}}", track);
+}
+
+void
+TraceWriter::complete(int track, const char *category, const QString &name,
+			quint64 start, quint64 duration, const Attribute::list &args)
+{
+	if (mFile == 0)
+		return;
+
+	beginEvent('X', track, category, name, start);
+	fprintf(mFile, ",\"dur\":%llu", (unsigned long long) duration);
+	endEvent(args);
+}
+
+void
+TraceWriter::instant(int track, const char *category, const QString &name,
+			quint64 when, const Attribute::list &args)
+{
+	if (mFile == 0)
+		return;
+
+	beginEvent('i', track, category, name, when);
+	fprintf(mFile, ",\"s\":\"t\"");
+	endEvent(args);
+}
+
+void
+TraceWriter::beginEvent(char phase, int track, const char *category, const QString &name, quint64 when)
+{
+	fprintf(mFile, "%s{\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%llu",
+			mCount++? ",\n" : "", phase, mPid, track, (unsigned long long) when);
+	if (category)
+		fprintf(mFile, ",\"cat\":\"%s\"", category);
+	fprintf(mFile, ",\"name\":");
+	writeString(name);
+}
+
+void
+TraceWriter::endEvent(const Attribute::list &args)
+{
+	if (!args.isEmpty()) {
+		fprintf(mFile, ",\"args\":{");
+		for (int i = 0; i < args.count(); ++i) {
+			if (i)
+				fputc(',', mFile);
+			writeString(args[i].name);
+			fputc(':', mFile);
+			writeString(args[i].value);
+		}
+		fputc('}', mFile);
+	}
+	fputc('}', mFile);
+}
+
+void
+TraceWriter::writeString(const QString &string)
+{
+	QByteArray utf8 = string.toUtf8();
+
+	fputc('"', mFile);
+	for (const char *s = utf8.constData(); *s; ++s) {
+		unsigned char c = *s;
+
+		if (c == '"' || c == '\\')
+			fprintf(mFile, "\\%c", c);
+		else
+		if (c < 0x20)
+			fprintf(mFile, "\\u%04x", c);
+		else
+			fputc(c, mFile);
+	}
+	fputc('"', mFile);
+}
+
+/*
+ * Write a trace of what happens, playback or not. Event handling shows
+ * up with its duration when we can hook event delivery; see
+ * eventprofile.cpp. Otherwise we only know when events come in.
+ */
+void
+Puppeteer::traceStart(const char *filename)
+{
+	const char *value;
+
+	mTrace = new TraceWriter;
+	if (!mTrace->open(QFile::decodeName(filename))) {
+		delete mTrace;
+		mTrace = 0;
+		return;
+	}
+
+	if ((value = getenv("PUPPETEER_TRACE_THRESHOLD")) != NULL)
+		mTraceThreshold = atoi(value);
+
+	if (mPaths == 0)
+		mPaths = new PathTable;
+
+	mTraceSlices = notifyHookStart();
+	if (mTraceSlices)
+		printf("=== Writing a trace to %s, with events handled in %u usec or more\n",
+				filename, mTraceThreshold);
+	else
+		printf("=== Writing a trace to %s, without event handling times\n", filename);
+
+	qApp->installEventFilter(this);
+}
+
+void
+Puppeteer::traceStop()
+{
+	if (mTraceSlices)
+		notifyHookStop();
+	mTraceSlices = false;
+
+	mTrace->close();
+	printf("=== Trace of %lu events written to %s\n", mTrace->count(), qPrintable(mTrace->filename()));
+}
+
+void
+Puppeteer::traceEventHandled(int track, QEvent::Type type, const char *className, quint32 pathId, quint64 started)
+{
+	quint64 duration = timestampUsec() - started;
+	Attribute::list args;
+
+	if (duration < mTraceThreshold)
+		return;
+
+	args.append(Attribute("class", className));
+	args.append(Attribute("object", mPaths->path(pathId)));
+	mTrace->complete(track, "event", eventTypeName(type), started, duration, args);
+}
+
+/*
+ * For when we can't tell how long it took
+ */
+void
+Puppeteer::traceEventSeen(QObject *object, QEvent *event)
+{
+	Attribute::list args;
+
+	args.append(Attribute("class", object->metaObject()->className()));
+	args.append(Attribute("object", mPaths->path(internObjectPath(object))));
+	mTrace->instant(mTrace->track(object), "event", eventTypeName(event->type()), timestampUsec(), args);
+}
+
+void
+Puppeteer::traceInjected(QWidget *widget, QEvent *event)
+{
+	Attribute::list args;
+
+	args.append(Attribute("object", mPaths->path(internObjectPath(widget))));
+	args.append(Attribute("step", QString::number(mStep)));
+	mTrace->instant(mTrace->track(widget), "inject", eventTypeName(event->type()), timestampUsec(), args);
+}
+
+void
+Puppeteer::traceStall(const RecordNode *stall)
+{
+	quint64 start = (quint64) (stall->attribute("timestamp").toDouble() * 1000000);
+	quint64 duration = (quint64) stall->attribute("duration").toULong() * 1000;
+	const RecordNode::list &frames = stall->children();
+	Attribute::list args;
+
+	for (int i = 0; i < frames.count() && i < 16; ++i)
+		args.append(Attribute(QString("#%1").arg(i), frames[i]->attribute("function")));
+	mTrace->complete(TraceWriter::WatchdogTrack, "stall", "stall", start, duration, args);
+}
+
+void
+Puppeteer::traceScriptStart(const QString &script)
+{
+	mTraceScript = QFileInfo(script).fileName();
+	mTraceScriptStart = timestampUsec();
+	mTraceStepStart = mTraceScriptStart;
+	mTracePerformStart = 0;
+	mTraceTimeout = -1;
+}
+
+void
+Puppeteer::traceScriptDone(int status)
+{
+	Attribute::list args;
+
+	// Already accounted for, or never started
+	if (mTraceScriptStart < 0)
+		return;
+
+	args.append(Attribute("status", exitStatusName(status)));
+	mTrace->complete(TraceWriter::ScriptTrack, "script", mTraceScript,
+			mTraceScriptStart, timestampUsec() - mTraceScriptStart, args);
+	mTraceScriptStart = -1;
+}
+
+/*
+ * A step is the time spent waiting - for an event, or for the timer
+ * to let things settle - followed by the time spent performing the
+ * action, if there is one.
+ */
+void
+Puppeteer::traceStep(const Script::Action *action, ExitStatus status)
+{
+	quint64 now = timestampUsec();
+	const char *category = "action";
+	QString name = action? action->name() : "none";
+	Attribute::list args;
+
+	if (action) {
+		switch (action->type()) {
+		case Script::WaitApplicationExit:
+		case Script::WaitEvent:
+			category = "wait";
+			break;
+		case Script::VerifyProperties:
+		case Script::VerifySnapshot:
+		case Script::VerifyImage:
+		case Script::Condition:
+			category = "verify";
+			break;
+		default: ;
+		}
+
+		if (action->event()) {
+			if (!action->event()->attribute("type").isEmpty())
+				name += " " + action->event()->attribute("type");
+			if (!action->event()->attribute("objectPath").isEmpty())
+				args.append(Attribute("object", action->event()->attribute("objectPath")));
+		}
+	}
+
+	args.append(Attribute("step", QString::number(mStep)));
+	args.append(Attribute("status", exitStatusName(status)));
+	if (mTraceTimeout >= 0)
+		args.append(Attribute("timer", QString("%1 msec").arg(mTraceTimeout)));
+	mTrace->complete(TraceWriter::ScriptTrack, category, name, mTraceStepStart, now - mTraceStepStart, args);
+
+	if (mTracePerformStart) {
+		mTrace->complete(TraceWriter::ScriptTrack, category, strcmp(category, "wait")? "settle" : "wait",
+				mTraceStepStart, mTracePerformStart - mTraceStepStart);
+		mTrace->complete(TraceWriter::ScriptTrack, category, "perform",
+				mTracePerformStart, now - mTracePerformStart);
+	}
+
+	if (status != ExitPass)
+		mTrace->instant(TraceWriter::ScriptTrack, "failure", exitStatusName(status), now);
+
+	mTraceStepStart = now;
+	mTracePerformStart = 0;
+	mTraceTimeout = -1;
+}
@@ -0,0 +1,79 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Timeline in the Chrome trace event format
+//
+//	A JSON array of trace events, which chrome://tracing,
+//	ui.perfetto.dev and friends can open. Everything happens
+//	on the GUI thread, but we put it on several tracks, which
+//	trace viewers know as threads: one for the script and its
+//	steps, one for stalls, one for events delivered to objects
+//	that are not widgets, and one for every top-level window.
+//
+//	Events are written as they happen, and the closing bracket
+//	is optional in this format, so a trace of an application
+//	that crashed can still be loaded.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_TRACE_H
+#define PUPPETEER_TRACE_H
+
+#include <qhash.h>
+#include <qpointer.h>
+#include <qwidget.h>
+#include <stdio.h>
+
+#include "puppeteer.h"
+
+class TraceWriter {
+public:
+	enum {
+		ScriptTrack = 1,
+		WatchdogTrack,
+		ApplicationTrack,
+		FirstWindowTrack,
+	};
+
+	TraceWriter();
+	~TraceWriter();
+
+	bool			open(const QString &filename);
+	void			close();
+
+	const QString &		filename() const { return mFilename; }
+	unsigned long		count() const { return mCount; }
+
+	// The track of the window the object lives in
+	int			track(QObject *);
+
+	// Times are in usec, see Puppeteer::timestampUsec()
+	void			complete(int track, const char *category, const QString &name,
+					quint64 start, quint64 duration,
+					const Attribute::list &args = Attribute::list());
+	void			instant(int track, const char *category, const QString &name,
+					quint64 when,
+					const Attribute::list &args = Attribute::list());
+
+private:
+	struct Window {
+		QPointer<QWidget> widget;
+		int		track;
+	};
+
+	void			nameTrack(int track, const QString &name);
+	void			beginEvent(char phase, int track, const char *category, const QString &name, quint64 when);
+	void			endEvent(const Attribute::list &args);
+	void			writeString(const QString &);
+
+	FILE *			mFile;
+	QString			mFilename;
+	int			mPid;
+	unsigned long		mCount;
+
+	QHash<QWidget *, Window> mWindows;
+	// A window that is opened again, as in every round of a soak test, gets its old track
+	QHash<QString, int>	mTracks;
+	int			mNextTrack;
+};
+
+#endif /* PUPPETEER_TRACE_H */
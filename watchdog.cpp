@@ -0,0 +1,167 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Event loop stall watchdog
+//
+//////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <unistd.h>
+#include "watchdog.h"
+#include "stack.h"
+#include "puppeteer.h"
+
+Watchdog::Watchdog(unsigned int thresholdMsec)
+: mThreshold(thresholdMsec), mProgress(0), mStalled(0),
+  mRunning(false), mStop(false), mEnded(false)
+{
+	if (mThreshold < 10)
+		mThreshold = 10;
+	pthread_mutex_init(&mLock, NULL);
+}
+
+Watchdog::~Watchdog()
+{
+	stop();
+	pthread_mutex_destroy(&mLock);
+}
+
+bool
+Watchdog::start()
+{
+	if (!stackCaptureInit())
+		return false;
+
+	// Have the clock started by this thread, rather than racing for it
+	Puppeteer::timestampUsec();
+
+	if (pthread_create(&mThread, NULL, threadMain, this) != 0) {
+		perror("pthread_create");
+		return false;
+	}
+
+	mRunning = true;
+	return true;
+}
+
+void
+Watchdog::stop()
+{
+	if (!mRunning)
+		return;
+
+	mStop = true;
+	pthread_join(mThread, NULL);
+	mRunning = false;
+}
+
+void *
+Watchdog::threadMain(void *arg)
+{
+	((Watchdog *) arg)->run();
+	return NULL;
+}
+
+void
+Watchdog::run()
+{
+	unsigned int last = __atomic_load_n(&mProgress, __ATOMIC_RELAXED);
+	quint64 lastChange = Puppeteer::timestampUsec();
+	bool stalled = false;
+
+	while (!mStop) {
+		unsigned int progress;
+		quint64 now;
+		QStringList stack;
+		void *frames[64];
+
+		usleep(mThreshold * 1000 / 4);
+
+		progress = __atomic_load_n(&mProgress, __ATOMIC_RELAXED);
+		now = Puppeteer::timestampUsec();
+		if (progress != last) {
+			last = progress;
+			lastChange = now;
+			stalled = false;
+			continue;
+		}
+
+		if (stalled || now - lastChange < (quint64) mThreshold * 1000)
+			continue;
+
+		stack = stackSymbolize(frames, stackCaptureMain(frames, 64, mThreshold));
+
+		fprintf(stderr, "=== Stall: the GUI thread has not handled an event for %u msec\n",
+				(unsigned int) ((now - lastChange) / 1000));
+		if (stack.isEmpty())
+			fprintf(stderr, "===   (no stack trace, the GUI thread did not respond)\n");
+		for (int i = 0; i < stack.count(); ++i)
+			fprintf(stderr, "===   #%-2d %s\n", i, qPrintable(stack[i]));
+
+		pthread_mutex_lock(&mLock);
+		mCurrent.start = lastChange;
+		mCurrent.duration = 0;
+		mCurrent.stack = stack;
+		pthread_mutex_unlock(&mLock);
+
+		__atomic_store_n(&mStalled, 1, __ATOMIC_RELEASE);
+		stalled = true;
+	}
+}
+
+void
+Watchdog::stallEnded()
+{
+	Stall stall;
+
+	pthread_mutex_lock(&mLock);
+	stall = mCurrent;
+	__atomic_store_n(&mStalled, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&mLock);
+
+	stall.duration = Puppeteer::timestampUsec() - stall.start;
+	mStalls.append(stall);
+	mEnded = true;
+}
+
+RecordNode *
+Watchdog::takeStall()
+{
+	const Stall *stall;
+	RecordNode *node;
+	QString value;
+
+	if (!mEnded)
+		return 0;
+	mEnded = false;
+	stall = &mStalls.last();
+
+	node = new RecordNode("stall");
+	node->addAttribute("timestamp", value.sprintf("%u.%06u",
+			(unsigned int) (stall->start / 1000000), (unsigned int) (stall->start % 1000000)));
+	node->addAttribute("duration", QString::number(stall->duration / 1000));
+	for (int i = 0; i < stall->stack.count(); ++i)
+		node->addChild("frame")->addAttribute("function", stall->stack[i]);
+	return node;
+}
+
+void
+Watchdog::report()
+{
+	quint64 total = 0;
+	int longest = 0;
+
+	if (mStalls.isEmpty())
+		return;
+
+	for (int i = 0; i < mStalls.count(); ++i) {
+		total += mStalls[i].duration;
+		if (mStalls[i].duration > mStalls[longest].duration)
+			longest = i;
+	}
+
+	printf("=== Watchdog: %d stalls of more than %u msec, %lu msec in total\n",
+			mStalls.count(), mThreshold, (unsigned long) (total / 1000));
+	printf("===   Longest: %lu msec, in:\n", (unsigned long) (mStalls[longest].duration / 1000));
+	for (int i = 0; i < mStalls[longest].stack.count(); ++i)
+		printf("===   #%-2d %s\n", i, qPrintable(mStalls[longest].stack[i]));
+}
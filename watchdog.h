@@ -0,0 +1,79 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Event loop stall watchdog
+//
+//	The GUI thread reports progress for every event it handles,
+//	and from a heartbeat timer when it is idle. A thread of our
+//	own checks on that; when there has been no progress for a
+//	while, it takes a stack trace of the GUI thread and prints
+//	it right away, in case the GUI thread never comes back.
+//
+//	Once the GUI thread is moving again, it picks up the stall
+//	with its duration and stack, to log it along with the
+//	events, and to add it to the report at exit.
+//
+//////////////////////////////////////////////////////////////////
+
+#ifndef PUPPETEER_WATCHDOG_H
+#define PUPPETEER_WATCHDOG_H
+
+#include <qstringlist.h>
+#include <qlist.h>
+#include <pthread.h>
+
+class RecordNode;
+
+class Watchdog {
+public:
+	Watchdog(unsigned int thresholdMsec);
+	~Watchdog();
+
+	bool			start();
+	void			stop();
+
+	unsigned int		threshold() const { return mThreshold; }
+
+	// GUI thread only
+	void			progress()
+				{
+					__atomic_add_fetch(&mProgress, 1, __ATOMIC_RELAXED);
+					if (__atomic_load_n(&mStalled, __ATOMIC_RELAXED))
+						stallEnded();
+				}
+
+	// The stall that just ended, as a <stall> record, if there is one
+	RecordNode *		takeStall();
+
+	void			report();
+
+private:
+	struct Stall {
+		quint64		start;		// usec, see Puppeteer::timestampUsec()
+		quint64		duration;
+		QStringList	stack;
+	};
+
+	static void *		threadMain(void *);
+	void			run();
+	void			stallEnded();
+
+	unsigned int		mThreshold;
+
+	// Written by the GUI thread, read by the watchdog
+	unsigned int		mProgress;
+
+	// Set by the watchdog, cleared by the GUI thread
+	int			mStalled;
+
+	pthread_t		mThread;
+	bool			mRunning;
+	volatile bool		mStop;
+
+	// Protects the rest
+	pthread_mutex_t		mLock;
+	Stall			mCurrent;
+	bool			mEnded;
+	QList<Stall>		mStalls;
+};
+
+#endif /* PUPPETEER_WATCHDOG_H */
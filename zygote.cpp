@@ -0,0 +1,140 @@
+//////////////////////////////////////////////////////////////////
+//
+//	Zygote mode: warm start for every script
+//
+//	The application calls Puppeteer::zygote() once it has done
+//	its expensive initialization, but before it creates the
+//	QApplication. If PUPPETEER_ZYGOTE names a list of scripts,
+//	we fork one child per script from that point; each child
+//	returns from zygote() and proceeds to open its own display
+//	connection and play back its script. The parent never
+//	returns; it collects the results and exits with the
+//	worst status.
+//
+//	The fork cannot happen any later: Xlib connection state
+//	is not something two processes can share, and Qt 4 cannot
+//	reopen its display once the QApplication is up.
+//
+//////////////////////////////////////////////////////////////////
+
+#include <qfile.h>
+#include <qmap.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "puppeteer.h"
+
+struct ZygoteChild {
+	QString		script;
+	struct timeval	started;
+};
+
+static void
+zygoteChild(const QString &script, unsigned int index, const char *logDir)
+{
+	setenv("PUPPETEER_PLAYBACK", QFile::encodeName(script), 1);
+	unsetenv("PUPPETEER_ZYGOTE");
+
+	if (logDir) {
+		// Scripts in different directories may have the same name,
+		// and a list may have the same script more than once
+		QString flat = QString(script).replace('/', '_');
+		QString path = QString("%1/%2-%3.log").arg(QFile::decodeName(logDir))
+					.arg(index + 1, 3, 10, QChar('0')).arg(flat);
+		int fd;
+
+		if ((fd = open(QFile::encodeName(path), O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+			perror(qPrintable(path));
+		} else {
+			dup2(fd, 1);
+			dup2(fd, 2);
+			close(fd);
+		}
+	}
+}
+
+void
+Puppeteer::zygote()
+{
+	QMap<pid_t, ZygoteChild> running;
+	unsigned int jobs = 1, next = 0;
+	int worst = ExitPass;
+	const char *value, *logDir;
+	QStringList scripts;
+
+	if ((value = getenv("PUPPETEER_ZYGOTE")) == NULL)
+		return;
+
+	scripts = expandScriptList(value);
+	if ((value = getenv("PUPPETEER_ZYGOTE_JOBS")) != NULL && atoi(value) > 0)
+		jobs = atoi(value);
+	logDir = getenv("PUPPETEER_ZYGOTE_LOGS");
+
+	printf("=== Zygote with %d scripts, %u at a time\n", scripts.count(), jobs);
+
+	while (next < (unsigned int) scripts.count() || !running.isEmpty()) {
+		struct timeval now, delta;
+		unsigned long msec;
+		const char *result;
+		int status, code;
+		pid_t pid;
+
+		while (next < (unsigned int) scripts.count() && (unsigned int) running.count() < jobs) {
+			ZygoteChild child;
+
+			child.script = scripts[next++];
+			gettimeofday(&child.started, NULL);
+
+			// Don't let children inherit unwritten output
+			fflush(stdout);
+			fflush(stderr);
+
+			if ((pid = fork()) < 0) {
+				perror("fork");
+				exit(ExitScriptError);
+			}
+
+			if (pid == 0) {
+				zygoteChild(child.script, next - 1, logDir);
+				return;
+			}
+
+			running.insert(pid, child);
+		}
+
+		if ((pid = waitpid(-1, &status, 0)) < 0) {
+			perror("waitpid");
+			exit(ExitScriptError);
+		}
+		if (!running.contains(pid))
+			continue;
+
+		ZygoteChild child = running.take(pid);
+
+		gettimeofday(&now, NULL);
+		timersub(&now, &child.started, &delta);
+		msec = delta.tv_sec * 1000 + delta.tv_usec / 1000;
+
+		if (WIFEXITED(status)) {
+			code = WEXITSTATUS(status);
+			if (code != ExitTimeout && code != ExitScriptError && code != ExitPass)
+				code = ExitFail;
+			result = exitStatusName(code);
+		} else {
+			code = ExitFail;
+			result = "CRASH";
+		}
+
+		printf("=== RESULT %s %lu msec %s\n", result, msec, qPrintable(child.script));
+		if (code > worst)
+			worst = code;
+	}
+
+	printf("=== Zygote done, exiting with status %d\n", worst);
+	fflush(stdout);
+	exit(worst);
+}